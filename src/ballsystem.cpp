@@ -1,130 +1,665 @@
 #include "ballsystem.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdio>
 
 #include "camera.h"
+#include "largearray.h"
+#include "scene.h"
 #include <iostream>
 #include "vertexrecorder.h"
 
 // TODO adjust to number of particles.
 const int NUM_PARTICLES = 50;
-const float mass = 1;
-const float drag_constant = 1;
 
-const float sphere_radius = 0.75f;
 const Vector3f FLOOR_COLOR(1.0f, 1.0f, 1.0f);
 
-BallSystem::BallSystem(float stepsize)
+// particles per cache block when reducing the per-worker collision buffers
+const int REDUCE_BLOCK = 1024;
+
+// state bytes per ball (position and velocity), for parallelForLarge
+const size_t BALL_STATE_BYTES = 2 * sizeof(Vector3f);
+
+BallSystem::BallSystem(float stepsize) : BallSystem(stepsize, NUM_PARTICLES)
 {
-    // make walls
-    _walls.emplace_back(Vector3f(-1, -3, -1), Vector3f(-1, -3, 1), Vector3f(1, -3, 1));  // floor
-    _walls.emplace_back(Vector3f(1, 1, 3.f), Vector3f(1, -3, 3.f), Vector3f(-1, 1, 5.f));  // front
-    _walls.emplace_back(Vector3f(-1, 3, 0.75f), Vector3f(-1, -3, 0.75f), Vector3f(1, 3, 0.f));  // back
-    _walls.emplace_back(Vector3f(-3, 1, 1), Vector3f(-3, -3, 1), Vector3f(-3, 1, -1));  // left
-    _walls.emplace_back(Vector3f(3, 1, -1), Vector3f(3, -1, -1), Vector3f(3, 1, 1));  // right
+}
 
+BallSystem::BallSystem(float stepsize, int num_particles) : BallSystem(stepsize, defaultScene(num_particles))
+{
+}
+
+BallSystem::BallSystem(float stepsize, const Scene& scene)
+{
+    _walls = scene.walls;
+    _planes = PlaneTable(_walls);
+    _meshes = scene.colliders;
 
     // big vector of 2n with position at even indices, velocity at odd
+    int num_particles = scene.numParticles();
+    reserveLargeArray(m_vVecState, scene.state.size());
+    m_vVecState = scene.state;
+    _radii = scene.radii;
+    _max_radius = 0;
+    for (int i=0; i<num_particles; i++) {
+        _max_radius = fmaxf(_max_radius, _radii[i]);
+    }
+    setCenters(m_vVecState, nullptr, 0);
+
+    _collided = std::vector<uint16_t>(num_particles, 0);
+    _freeze_contacts = false;
+    _stepsize = stepsize;
+    _mass = scene.mass;
+    _drag = scene.drag;
+
+    _compact_storage = scene.compact_storage;
+    if (_compact_storage) {
+        _packed_colors.resize(num_particles);
+        for (int i=0; i<num_particles; i++) {
+            uint32_t packed = 0xff000000u;  // opaque
+            for (int k=0; k<3; k++) {
+                float c = scene.colors[i][k];
+                packed |= (uint32_t)(c <= 0 ? 0 : c >= 1 ? 255 : c * 255 + 0.5f) << (8 * k);
+            }
+            _packed_colors[i] = packed;
+        }
+    } else {
+        _colors = scene.colors;
+    }
+    for (int i=0; i<num_particles; i++) {
+        _ids.push_back(i);
+    }
+
+    _broadphase = scene.broadphase;
+    _reorder_interval = scene.reorder_interval;
+    _steps_since_reorder = 0;
+    _step_context = false;
+    _collision_mode = scene.collision_mode;
+}
 
-    for (int i=0; i<NUM_PARTICLES; i++) {
-        Vector3f position = Vector3f((i%3)-1, (i+1) * 1, 4);
-        m_vVecState.push_back(position);  // position
-        m_vVecState.emplace_back(rand_uniform(0, 1), rand_uniform(0, 1), rand_uniform(0, 1));  // velocity
 
-        // add sphere rep for each
-        _spheres.emplace_back(position, sphere_radius);
+bool BallSystem::addMeshCollider(const std::string& path)
+{
+    MeshCollider mesh;
+    if (!mesh.load(path)) {
+        return false;
     }
+    _meshes.push_back(mesh);
+    return true;
+}
 
-    _collided = std::vector<int>(NUM_PARTICLES, 0);
-    _stepsize = stepsize;
 
-    for (int i=0; i<NUM_PARTICLES; i++) {
-        _colors.emplace_back(rand_uniform(0, 1), rand_uniform(0, 1), rand_uniform(0, 1));
+void BallSystem::setRadii(const std::vector<float>& radii)
+{
+    assert(radii.size() == _radii.size());
+    _radii = radii;
+    _max_radius = 0;
+    for (size_t i=0; i<_radii.size(); i++) {
+        _max_radius = fmaxf(_max_radius, radii[i]);
     }
 }
 
 
-std::vector<Vector3f> BallSystem::evalF(std::vector<Vector3f>& state)
+Vector3f BallSystem::color(int i) const
 {
-    // need to first update sphere positions to the particles (not handled during time step)
-    for (int i=0; i<_spheres.size(); i+=1) {
-        Vector3f current_position = state[i*2];  // get position in combined vector
-        _spheres[i].updateCenter(current_position);
+    if (!_compact_storage) {
+        return _colors[i];
+    }
+    uint32_t packed = _packed_colors[i];
+    return Vector3f((packed & 0xff) / 255.0f, ((packed >> 8) & 0xff) / 255.0f, ((packed >> 16) & 0xff) / 255.0f);
+}
+
+
+void BallSystem::setCenters(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a)
+{
+    int n = numBalls();
+    reserveLargeArray(_cx, n); reserveLargeArray(_cy, n); reserveLargeArray(_cz, n);
+    _cx.resize(n); _cy.resize(n); _cz.resize(n);
+    parallelForLarge(n, BALL_STATE_BYTES, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            Vector3f current_position = k ? x[i*2] + a * (*k)[i*2] : x[i*2];  // get position in combined vector
+            _cx[i] = current_position[0];
+            _cy[i] = current_position[1];
+            _cz[i] = current_position[2];
+        }
+    });
+}
+
+
+void BallSystem::buildCandidates(float margin)
+{
+    int n = numBalls();
+    SphereSet spheres = sphereSet();
+    // contact slack of intersectsSphere, plus how far balls may move before the next rebuild
+    float slack = 0.001f + margin;
+
+    _pairs.clear();
+    if (_broadphase == BROADPHASE_HIERARCHICAL_GRID) {
+        _hgrid.build(spheres, slack);
+        _hgrid.findPairs(spheres, _pairs);
+    } else {
+        _grid.build(spheres, 2 * _max_radius + slack);
+        std::vector<int>& candidates = _candidates;
+        for (int i=0; i<n; i++) {
+            candidates.clear();
+            _grid.query(spheres.center(i), candidates);
+            for (int j : candidates) {
+                if (j > i) {
+                    _pairs.emplace_back(i, j);
+                }
+            }
+        }
+    }
+
+    // keep the pairs that can touch
+    size_t kept = 0;
+    for (size_t p=0; p<_pairs.size(); p++) {
+        int i = _pairs[p].first;
+        int j = _pairs[p].second;
+        float reach = _radii[i] + _radii[j] + slack;
+        if ((spheres.center(j) - spheres.center(i)).absSquared() <= reach * reach) {
+            _pairs[kept++] = _pairs[p];
+        }
+    }
+    _pairs.resize(kept);
+    if (_collision_mode != COLLIDE_PER_BALL) {
+        return;  // the pair modes only need the compact pair list
+    }
+
+    // per-ball CSR lists holding both orders
+    _neighbor_start.assign(n + 1, 0);
+    for (const std::pair<int, int>& p : _pairs) {
+        _neighbor_start[p.first + 1] += 1;
+        _neighbor_start[p.second + 1] += 1;
+    }
+    for (int i=0; i<n; i++) {
+        _neighbor_start[i + 1] += _neighbor_start[i];
+    }
+    _neighbors.resize(2 * kept);
+    std::vector<int>& fill = _candidates;
+    fill.assign(_neighbor_start.begin(), _neighbor_start.end() - 1);
+    for (const std::pair<int, int>& p : _pairs) {
+        _neighbors[fill[p.first]++] = p.second;
+        _neighbors[fill[p.second]++] = p.first;
+    }
+}
+
+
+void BallSystem::printBroadphaseStats() const
+{
+    printf("broadphase: %d candidate pairs\n", (int)_pairs.size());
+    if (_broadphase == BROADPHASE_HIERARCHICAL_GRID) {
+        _hgrid.printStats();
+    } else if (_broadphase == BROADPHASE_GRID) {
+        printf("grid: cell %.3f  balls %d  occupied buckets %d  max bucket %d\n",
+               _grid.cellSize(), _grid.size(), _grid.occupiedBuckets(), _grid.maxBucketLoad());
+    }
+}
+
+
+template <typename T>
+static size_t heapBytes(const std::vector<T>& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+void BallSystem::printMemoryFootprint() const
+{
+    int n = numBalls();
+    if (n == 0) {
+        return;
+    }
+    size_t force_buffers = heapBytes(_force_buffers);
+    for (const std::vector<Vector3f>& buffer : _force_buffers) {
+        force_buffers += heapBytes(buffer);
+    }
+    size_t spares = heapBytes(_reorder_keys) + heapBytes(_spare_state) + heapBytes(_spare_radii) +
+                    heapBytes(_spare_collided) + heapBytes(_spare_colors) + heapBytes(_spare_packed_colors) +
+                    heapBytes(_spare_ids);
+    struct { const char* name; size_t bytes; } parts[] = {
+        {"state", heapBytes(m_vVecState) + heapBytes(m_vNextState)},
+        {"precise state", heapBytes(m_vPreciseState) + heapBytes(m_vNextPreciseState)},
+        {"radii", heapBytes(_radii)},
+        {"centers", heapBytes(_cx) + heapBytes(_cy) + heapBytes(_cz)},
+        {"colors", heapBytes(_colors) + heapBytes(_packed_colors)},
+        {"contact counters", heapBytes(_collided)},
+        {"ids", heapBytes(_ids)},
+        {"wall scratch", heapBytes(_wall_hits) + heapBytes(_wall_depths)},
+        {"pair forces", heapBytes(_pair_forces) + force_buffers},
+        {"candidates", heapBytes(_pairs) + heapBytes(_neighbor_start) + heapBytes(_neighbors) + heapBytes(_candidates)},
+        {"grid", _grid.memoryBytes() + _hgrid.memoryBytes()},
+        {"reorder spares", spares},
+        {"step arena", m_arena.capacityBytes()},
+    };
+    size_t total = 0;
+    printf("memory per ball (%d balls, %s storage):\n", n, _compact_storage ? "compact" : "full");
+    for (const auto& part : parts) {
+        if (part.bytes > 0) {
+            printf("  %-16s %8.1f B\n", part.name, (double)part.bytes / n);
+        }
+        total += part.bytes;
+    }
+    printf("  %-16s %8.1f B  (%.2f MB)\n", "total", (double)total / n, total / 1048576.0);
+}
+
+
+void BallSystem::beginStep(float stepSize)
+{
+    if (_broadphase == BROADPHASE_ALL_PAIRS) {
+        return;
+    }
+    int n = numBalls();
+
+    // stage states stay within about h * |v| of the current one, so pairs that
+    // can touch during this step are within both radii plus both balls' travel
+    setCenters(m_vVecState, nullptr, 0);
+    float max_speed_sq = 0;
+    for (int i=0; i<n; i++) {
+        max_speed_sq = fmaxf(max_speed_sq, m_vVecState[2*i+1].absSquared());
+    }
+    buildCandidates(2 * sqrtf(max_speed_sq) * stepSize);
+    _step_context = true;
+}
+
+
+void BallSystem::endStep()
+{
+    _step_context = false;
+    _steps_since_reorder += 1;
+    if (_reorder_interval > 0 && _steps_since_reorder >= _reorder_interval) {
+        reorderParticles();
+    }
+}
+
+
+void BallSystem::reorderParticles()
+{
+    _steps_since_reorder = 0;
+    int n = numBalls();
+    if (n < 2) {
+        return;
+    }
+
+    // quantize positions to cells inside the bounding box of all balls
+    Vector3f lo = m_vVecState[0];
+    Vector3f hi = m_vVecState[0];
+    for (int i=1; i<n; i++) {
+        for (int k=0; k<3; k++) {
+            lo[k] = fminf(lo[k], m_vVecState[2*i][k]);
+            hi[k] = fmaxf(hi[k], m_vVecState[2*i][k]);
+        }
+    }
+    // cells no smaller than one ball, at most 2^21 per axis
+    float cell = fmaxf(2 * _max_radius, fmaxf(hi[0] - lo[0], fmaxf(hi[1] - lo[1], hi[2] - lo[2])) / ((1 << 21) - 1));
+
+    // sort (code, index) so equal codes keep their relative order
+    std::vector<std::pair<uint64_t, int>>& keys = _reorder_keys;
+    keys.resize(n);
+    for (int i=0; i<n; i++) {
+        Vector3f p = m_vVecState[2*i];
+        keys[i].first = mortonCode((uint32_t)((p[0] - lo[0]) / cell),
+                                   (uint32_t)((p[1] - lo[1]) / cell),
+                                   (uint32_t)((p[2] - lo[2]) / cell));
+        keys[i].second = i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // gather every per-particle array through the same permutation into the
+    // spare copies, then swap: the old arrays are the spares for the next reorder
+    std::vector<Vector3f>& state = _spare_state;
+    std::vector<float>& radii = _spare_radii;
+    std::vector<uint16_t>& collided = _spare_collided;
+    std::vector<Vector3f>& colors = _spare_colors;
+    std::vector<uint32_t>& packed_colors = _spare_packed_colors;
+    std::vector<int>& ids = _spare_ids;
+    reserveLargeArray(state, m_vVecState.size());
+    state.resize(m_vVecState.size());
+    radii.resize(n);
+    collided.resize(n);
+    colors.resize(_colors.size());
+    packed_colors.resize(_packed_colors.size());
+    ids.resize(n);
+    for (int i=0; i<n; i++) {
+        int from = keys[i].second;
+        state[2*i] = m_vVecState[2*from];
+        state[2*i+1] = m_vVecState[2*from+1];
+        radii[i] = _radii[from];
+        collided[i] = _collided[from];
+        ids[i] = _ids[from];
+    }
+    if (_compact_storage) {
+        for (int i=0; i<n; i++) {
+            packed_colors[i] = _packed_colors[keys[i].second];
+        }
+    } else {
+        for (int i=0; i<n; i++) {
+            colors[i] = _colors[keys[i].second];
+        }
+    }
+    m_vVecState.swap(state);
+    invalidatePreciseState();
+    _radii.swap(radii);
+    _collided.swap(collided);
+    _colors.swap(colors);
+    _packed_colors.swap(packed_colors);
+    _ids.swap(ids);
+}
+
+
+void BallSystem::saveSnapshot(std::vector<char>& out) const
+{
+    ParticleSystem::saveSnapshot(out);
+    snapshotWrite(out, _collided);
+    snapshotWrite(out, _ids);
+    snapshotWriteValue(out, _steps_since_reorder);
+}
+
+
+void BallSystem::loadSnapshot(const char*& in)
+{
+    ParticleSystem::loadSnapshot(in);
+    snapshotRead(in, _collided);
+    std::vector<int> ids;
+    snapshotRead(in, ids);
+    snapshotReadValue(in, _steps_since_reorder);
+    if (ids == _ids) {
+        return;
     }
 
+    // reordered since the snapshot: bring radii and colors into its order
+    int n = (int)ids.size();
+    std::vector<int> slot(n);
+    for (int i=0; i<n; i++) {
+        slot[_ids[i]] = i;
+    }
+    std::vector<float> radii(n);
+    std::vector<Vector3f> colors(_colors.size());
+    std::vector<uint32_t> packed_colors(_packed_colors.size());
+    for (int i=0; i<n; i++) {
+        int from = slot[ids[i]];
+        radii[i] = _radii[from];
+        if (_compact_storage) {
+            packed_colors[i] = _packed_colors[from];
+        } else {
+            colors[i] = _colors[from];
+        }
+    }
+    _radii.swap(radii);
+    _colors.swap(colors);
+    _packed_colors.swap(packed_colors);
+    _ids.swap(ids);
+}
+
+
+std::vector<Vector3f> BallSystem::evalF(const std::vector<Vector3f>& state)
+{
+    std::vector<Vector3f> f;
+    evalFInto(state, f);
+    return f;
+}
+
 
+void BallSystem::evalFInto(const std::vector<Vector3f>& state, std::vector<Vector3f>& f)
+{
     // even position - velocity; odd position - acceleration
-    std::vector<Vector3f> f(state.size(), Vector3f(0, 0, 0));
+    f.resize(state.size());
+    evalStage(state, nullptr, 0, f, nullptr, 0, false);
+}
+
 
-    for (int i=0; i<_spheres.size(); i+=1) {  //position and velocity stored in same
-        // VELOCITY
-        Vector3f vel = state[2*i+1];
-        f[i*2] += vel; // derivative of position is velocity
+void BallSystem::jacobianProduct(const std::vector<Vector3f>& state, const std::vector<Vector3f>& f,
+                                 const std::vector<Vector3f>& dstate, std::vector<Vector3f>& out)
+{
+    // the shifted evaluations probe the operator f came from, so they must not
+    // count contacts (backward Euler makes hundreds of them per step) nor see
+    // the counters move from one probe to the next
+    _freeze_contacts = true;
+    ParticleSystem::jacobianProduct(state, f, dstate, out);
+    _freeze_contacts = false;
+}
 
-        // ACCELERATION
-        Vector3f net_force = Vector3f(0, 0, 0);
-        net_force[1] = net_force[1] - 9.8 * mass;  // gravity
-        net_force = net_force - drag_constant * vel;  // drag
 
-        net_force = (net_force/mass);
+void BallSystem::evalFStage(float a, const std::vector<Vector3f>& kin, std::vector<Vector3f>& kout,
+                            std::vector<Vector3f>& sum, float w, bool accumulate)
+{
+    kout.resize(m_vVecState.size());
+    sum.resize(m_vVecState.size());
+    evalStage(m_vVecState, a == 0 ? nullptr : &kin, a, kout, &sum, w, accumulate);
+}
 
-        // Collision detection -- stop ball movement as collision detected
-        //TODO: collision resolution
-        Vector3f collision_force = Vector3f(0, 0, 0);
 
-        for (int j=0; j<_spheres.size(); j+=1){
+void BallSystem::evalStage(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a,
+                           std::vector<Vector3f>& f, std::vector<Vector3f>* sum, float w, bool accumulate)
+{
+    // need to first update sphere positions to the particles (not handled during time step)
+    int n = numBalls();
+    setCenters(x, k, a);
+
+    // every sphere against every wall plane in one pass
+    reserveLargeArray(_wall_hits, n);
+    reserveLargeArray(_wall_depths, (size_t)n * _planes.size());
+    _wall_hits.resize(n);
+    _wall_depths.resize((size_t)n * _planes.size());
+    // in chunks of whole SSE groups, so every ball takes the same path through the kernel
+    parallelForLarge((n + 3) / 4, 4 * BALL_STATE_BYTES, [&](int begin, int end) {
+        int lo = begin * 4;
+        int hi = std::min(n, end * 4);
+        intersectsPlanes(_planes, _cx.data() + lo, _cy.data() + lo, _cz.data() + lo, _radii.data() + lo, hi - lo,
+                         _wall_hits.data() + lo, _wall_depths.data() + lo, n);
+    });
+
+    if (_broadphase != BROADPHASE_ALL_PAIRS && !_step_context) {
+        buildCandidates(0);
+    }
+
+    // velocity at the stage state, then the weighted sum while the ball is still in cache
+    auto ball = [&](int i, Vector3f collision_force) {
+        Vector3f vel = k ? x[i*2+1] + a * (*k)[i*2+1] : x[i*2+1];
+        evalBall(i, vel, f, collision_force);
+        if (sum) {
+            std::vector<Vector3f>& s = *sum;
+            s[i*2] = accumulate ? s[i*2] + w * f[i*2] : w * f[i*2];
+            s[i*2+1] = accumulate ? s[i*2+1] + w * f[i*2+1] : w * f[i*2+1];
+        }
+    };
+
+    if (_collision_mode == COLLIDE_PAIRS_PARALLEL && _broadphase != BROADPHASE_ALL_PAIRS) {
+        // each pair once across the workers, then every ball independently
+        ThreadPool& pool = ThreadPool::shared();
+        collidePairsParallel(pool);
+        pool.parallelFor(n, [&](int worker, int begin, int end) {
+            for (int i=begin; i<end; i++) {
+                ball(i, _pair_forces[i]);
+            }
+        });
+    } else if (_collision_mode != COLLIDE_PER_BALL) {
+        collidePairs();
+        parallelForLarge(n, BALL_STATE_BYTES, [&](int begin, int end) {
+            for (int i=begin; i<end; i+=1) {
+                ball(i, _pair_forces[i]);
+            }
+        });
+    } else {
+        parallelForLarge(n, BALL_STATE_BYTES, [&](int begin, int end) {
+            for (int i=begin; i<end; i+=1) {  //position and velocity stored in same
+                ball(i, ballContactForce(i));
+            }
+        });
+    }
+}
+
+
+Vector3f BallSystem::ballContactForce(int i)
+{
+    Vector3f collision_force = Vector3f(0, 0, 0);
+
+    // narrowphase only on the broadphase candidates (cached for the whole step inside takeStep)
+    SphereSet spheres = sphereSet();
+    if (_broadphase == BROADPHASE_ALL_PAIRS) {
+        for (int j=0; j<spheres.count; j+=1) {
             if (i == j) {
                 continue;
             }
             Hit hit = Hit();
-            if (_spheres[i].intersectsSphere(_spheres[j], hit)) {
+            if (spheres.sphere(i).intersectsSphere(spheres.sphere(j), hit)) {
                 collision_force += hit.resolveDirection * hit.resolveDist * 1/_stepsize * 10;
             }
         }
+        return collision_force;
+    }
 
-        for (int j=0; j<_walls.size(); j+=1) {
-            Hit hit = Hit();
-            if (_spheres[i].intersectsWall(_walls[j], hit)) {
-                _collided[i] += 1;
-
-                collision_force += _walls[j]._normal * fmax(0.5, abs(Vector3f::dot(_walls[j]._normal, vel))) * 0.1/_stepsize;
-                if (j==0) {  // floor needs more power to counteract gravity
-                    collision_force += _walls[j]._normal * 30/_stepsize;
-
-                    if (_collided[i] >= 50) {
-                        if (vel.absSquared() + collision_force.absSquared() - net_force.absSquared() < 2500) {
-                            collision_force = Vector3f(0);
-                            net_force = Vector3f(0);
-                            f[i*2] = Vector3f(0);
-                        } else {
-                            _collided[i] = 0;
-                        }
+    for (int c=_neighbor_start[i]; c<_neighbor_start[i + 1]; c++){
+        int j = _neighbors[c];
+        Hit hit = Hit();
+        if (spheres.sphere(i).intersectsSphere(spheres.sphere(j), hit)) {
+            collision_force += hit.resolveDirection * hit.resolveDist * 1/_stepsize * 10;
+        }
+    }
+    return collision_force;
+}
+
+
+void BallSystem::contactPair(int i, int j, std::vector<Vector3f>& forces)
+{
+    Hit hit, other_hit;
+    SphereSet spheres = sphereSet();
+    if (spheres.sphere(i).intersectsSpherePair(spheres.sphere(j), hit, other_hit)) {
+        forces[i] += hit.resolveDirection * hit.resolveDist * 1/_stepsize * 10;
+        forces[j] += other_hit.resolveDirection * other_hit.resolveDist * 1/_stepsize * 10;
+    }
+}
+
+
+void BallSystem::collidePairs()
+{
+    int n = numBalls();
+    reserveLargeArray(_pair_forces, n);
+    _pair_forces.assign(n, Vector3f(0, 0, 0));
+
+    if (_broadphase == BROADPHASE_ALL_PAIRS) {
+        for (int i=0; i<n; i++) {
+            for (int j=i+1; j<n; j++) {
+                contactPair(i, j, _pair_forces);
+            }
+        }
+        return;
+    }
+    for (const std::pair<int, int>& p : _pairs) {
+        contactPair(p.first, p.second, _pair_forces);
+    }
+}
+
+
+void BallSystem::collidePairsParallel(ThreadPool& pool)
+{
+    int n = numBalls();
+    int workers = pool.size();
+
+    // private accumulation buffers, left zeroed by the previous reduction
+    if ((int)_force_buffers.size() != workers || (int)_force_buffers[0].size() != n) {
+        _force_buffers.assign(workers, std::vector<Vector3f>(n, Vector3f(0, 0, 0)));
+    }
+
+    pool.parallelFor((int)_pairs.size(), [&](int worker, int begin, int end) {
+        std::vector<Vector3f>& forces = _force_buffers[worker];
+        for (int p=begin; p<end; p++) {
+            contactPair(_pairs[p].first, _pairs[p].second, forces);
+        }
+    });
+
+    // reduce block by block, always adding the buffers in worker order so the
+    // sums don't depend on scheduling; clears the buffers for the next call
+    reserveLargeArray(_pair_forces, n);
+    _pair_forces.resize(n);
+    int blocks = (n + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+    pool.parallelFor(blocks, [&](int worker, int begin, int end) {
+        for (int b=begin; b<end; b++) {
+            int lo = b * REDUCE_BLOCK;
+            int hi = std::min(n, lo + REDUCE_BLOCK);
+            for (int i=lo; i<hi; i++) {
+                _pair_forces[i] = _force_buffers[0][i];
+                _force_buffers[0][i] = Vector3f(0, 0, 0);
+            }
+            for (int w=1; w<workers; w++) {
+                std::vector<Vector3f>& forces = _force_buffers[w];
+                for (int i=lo; i<hi; i++) {
+                    _pair_forces[i] += forces[i];
+                    forces[i] = Vector3f(0, 0, 0);
+                }
+            }
+        }
+    });
+}
+
+
+void BallSystem::evalBall(int i, Vector3f vel, std::vector<Vector3f>& f, Vector3f collision_force)
+{
+    // VELOCITY
+    f[i*2] = vel; // derivative of position is velocity
+
+    // ACCELERATION
+    Vector3f net_force = Vector3f(0, 0, 0);
+    net_force[1] = net_force[1] - 9.8 * _mass;  // gravity
+    net_force = net_force - _drag * vel;  // drag
+
+    net_force = (net_force/_mass);
+
+    // Collision detection -- stop ball movement as collision detected
+    //TODO: collision resolution
+    int collided = _collided[i];
+    for (int j=0; j<_walls.size(); j+=1) {
+        if (_wall_hits[i] & (1u << j)) {
+            if (collided < UINT16_MAX) {  // only ever compared against small counts
+                collided += 1;
+            }
+
+            collision_force += _walls[j]._normal * fmax(0.5, abs(Vector3f::dot(_walls[j]._normal, vel))) * 0.1/_stepsize;
+            if (j==0) {  // floor needs more power to counteract gravity
+                collision_force += _walls[j]._normal * 30/_stepsize;
+
+                if (collided >= 50) {
+                    if (vel.absSquared() + collision_force.absSquared() - net_force.absSquared() < 2500) {
+                        collision_force = Vector3f(0);
+                        net_force = Vector3f(0);
+                        f[i*2] = Vector3f(0);
+                    } else {
+                        collided = 0;
                     }
                 }
             }
         }
+    }
+    if (!_freeze_contacts) {
+        _collided[i] = (uint16_t)collided;
+    }
 
-        f[i*2+1] = net_force + collision_force;
+    // static meshes: penalty on penetration depth like ball contacts, plus the wall bounce
+    for (const MeshCollider& mesh : _meshes) {
+        Hit hit = Hit();
+        if (mesh.intersectsSphere(Vector3f(_cx[i], _cy[i], _cz[i]), _radii[i], hit)) {
+            collision_force += hit.resolveDirection * hit.resolveDist * 1/_stepsize * 10;
+            collision_force += hit.resolveDirection * fmax(0.5, abs(Vector3f::dot(hit.resolveDirection, vel))) * 0.1/_stepsize;
+        }
     }
 
-    return f;
+    f[i*2+1] = net_force + collision_force;
 }
 
 // render the system (ie draw the particles)
 void BallSystem::draw(GLProgram& gl)
 {
-    std::vector<Vector3f> current = getState();
+    Span<const Vector3f> current = stateView();
 
     // TODO 4.2, 4.3
 
     // example code. Replace with your own drawing  code
     for (int i=0; i<current.size(); i+=2) {
-        gl.updateMaterial(_colors[i/2]);
+        gl.updateMaterial(color(i/2));
         Vector3f pos = current[i];
 
         gl.updateModelMatrix(Matrix4f::translation(pos));
-        drawSphere(sphere_radius, 10, 10);
+        drawSphere(_radii[i/2], 10, 10);
     }
 
     // set uniforms for floor
@@ -136,6 +671,28 @@ void BallSystem::draw(GLProgram& gl)
     gl.updateModelMatrix(Matrix4f::rotateX(1.57) * Matrix4f::translation(0, -15, 0));
     drawQuad(50.0f);
 
+    // mesh colliders as flat shaded triangles
+    if (!_meshes.empty()) {
+        gl.updateMaterial(FLOOR_COLOR);
+        gl.updateModelMatrix(Matrix4f::identity());
+        size_t indices = 0;
+        for (const MeshCollider& mesh : _meshes) {
+            indices += mesh.indices().size();
+        }
+        VertexRecorder mesh_rec((int)indices);
+        for (const MeshCollider& mesh : _meshes) {
+            const std::vector<Vector3f>& v = mesh.vertices();
+            const std::vector<int>& idx = mesh.indices();
+            for (size_t t=0; t+2<idx.size(); t+=3) {
+                Vector3f n = Vector3f::cross(v[idx[t+1]] - v[idx[t]], v[idx[t+2]] - v[idx[t]]).normalized();
+                mesh_rec.record(v[idx[t]], n);
+                mesh_rec.record(v[idx[t+1]], n);
+                mesh_rec.record(v[idx[t+2]], n);
+            }
+        }
+        mesh_rec.draw();
+    }
+
     gl.disableLighting();
     gl.updateModelMatrix(Matrix4f::identity()); // update uniforms after mode change
     VertexRecorder rec;
@@ -1,41 +1,155 @@
 #ifndef PENDULUMSYSTEM_H
 #define PENDULUMSYSTEM_H
 
+#include <cstdint>
 #include <vector>
 
 #include "particlesystem.h"
 #include "wall.h"
 #include "sphere.h"
+#include "spatialgrid.h"
+#include "hierarchicalgrid.h"
+#include "trianglemesh.h"
+#include "threadpool.h"
 
-class Spring {
-public:
-    Spring(int end1, int end2, float rest_length, float stiffness);
-
-    int end1;
-    int end2;
+enum Broadphase {
+    BROADPHASE_ALL_PAIRS,  // test every ball against every other ball
+    BROADPHASE_GRID,  // uniform hash grid, one cell per largest ball diameter
+    BROADPHASE_HIERARCHICAL_GRID  // one hash grid level per radius class, for mixed sizes
+};
 
-    float rest_length;
-    float stiffness;
+enum CollisionMode {
+    COLLIDE_PER_BALL,  // each ball walks its candidate list, every pair is tested from both ends
+    COLLIDE_PAIRS,  // each pair once, equal and opposite responses to both balls
+    COLLIDE_PAIRS_PARALLEL  // each pair once on the shared thread pool, per-worker force buffers
 };
 
-class BallSystem : public ParticleSystem
+struct Scene;
+
+class BallSystem final : public ParticleSystem
 {
 public:
     BallSystem(float stepsize);
+    BallSystem(float stepsize, int num_particles);
+    // particles, walls, colliders and constants from a scene (see scene.h)
+    BallSystem(float stepsize, const Scene& scene);
+
+    std::vector<Vector3f> evalF(const std::vector<Vector3f>& state) override;
+    void evalFInto(const std::vector<Vector3f>& state, std::vector<Vector3f>& f) override;
+    void evalFStage(float a, const std::vector<Vector3f>& kin, std::vector<Vector3f>& kout,
+                    std::vector<Vector3f>& sum, float w, bool accumulate) override;
+    // the base finite difference, with the wall contact counters left as they are
+    void jacobianProduct(const std::vector<Vector3f>& state, const std::vector<Vector3f>& f,
+                         const std::vector<Vector3f>& dstate, std::vector<Vector3f>& out) override;
+    void draw(GLProgram&) override;
+
+    // builds the step's candidate pair lists once, reused by every stage's evalF
+    void beginStep(float stepSize) override;
+    // drops the cached pairs and runs the periodic particle reorder
+    void endStep() override;
+
+    // sort every per-particle array by the Morton code of the ball position
+    void reorderParticles();
+
+    // adds the contact counters and the particle order (radii and colors
+    // follow the ids back on load) to the base snapshot
+    void saveSnapshot(std::vector<char>& out) const override;
+    void loadSnapshot(const char*& in) override;
+
+    double kineticEnergy() const override { return _mass * ParticleSystem::kineticEnergy(); }
+
+    // give every ball its own radius (mixed-size sets)
+    void setRadii(const std::vector<float>& radii);
 
-    std::vector<Vector3f> evalF(std::vector<Vector3f>& state) override;
-    void draw(GLProgram&);
+    int numBalls() const { return (int)_radii.size(); }
+    // color of ball i, whichever way it is stored
+    Vector3f color(int i) const;
+
+    // bytes per ball by component, what they hold now (capacity, scratch included)
+    void printMemoryFootprint() const;
+
+    // run the broadphase into _pairs and the CSR lists, margin widens the contact reach
+    void buildCandidates(float margin);
+    void printBroadphaseStats() const;
+
+    // ball centers at state x + a * k (k null for x itself) into _cx/_cy/_cz
+    void setCenters(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a);
+    SphereSet sphereSet() const { return SphereSet{_cx.data(), _cy.data(), _cz.data(), _radii.data(), numBalls()}; }
+
+    // ball-ball contact force on ball i from its candidate list
+    Vector3f ballContactForce(int i);
+    // contact response of pair (i, j) added to both balls
+    void contactPair(int i, int j, std::vector<Vector3f>& forces);
+    // every candidate pair once, into _pair_forces
+    void collidePairs();
+    // every candidate pair once across the pool, reduced into _pair_forces
+    void collidePairsParallel(ThreadPool& pool);
+    // derivative f at the state x + a * k (k null for x itself), summed into
+    // sum per ball when sum is given; shared body of evalF and evalFStage
+    void evalStage(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a,
+                   std::vector<Vector3f>& f, std::vector<Vector3f>* sum, float w, bool accumulate);
+    // gravity, drag, walls and meshes for ball i on top of its ball contact force
+    void evalBall(int i, Vector3f vel, std::vector<Vector3f>& f, Vector3f collision_force);
+
+    // load a static OBJ/PLY triangle mesh the balls collide with, false on error
+    bool addMeshCollider(const std::string& path);
 
     // inherits 
     // std::vector<Vector3f> m_vVecState;
 
     float _stepsize;
+    float _mass;  // per ball, defaults to the scene constant
+    float _drag;
 
     std::vector<Wall> _walls;
-    std::vector<Sphere> _spheres;  // note indexed for each particle
+    PlaneTable _planes;  // SoA copy of _walls, rebuild if _walls changes
+    std::vector<MeshCollider> _meshes;
+    std::vector<float> _radii;  // per ball
+    // centers at the state being evaluated (the stage state inside a step), as
+    // SoA for the all-walls kernel and the grids; not kept anywhere else
+    std::vector<float> _cx, _cy, _cz;
 
-    std::vector<int> _collided;
+    std::vector<uint16_t> _collided;  // consecutive wall contacts, saturating
+    bool _freeze_contacts;  // evalF reads but does not update _collided (Jacobian probes)
+    // compact storage keeps colors as RGBA8 in _packed_colors, else as floats in _colors
+    bool _compact_storage;
     std::vector<Vector3f> _colors;
+    std::vector<uint32_t> _packed_colors;
+    std::vector<int> _ids;  // creation index of each particle, follows it through reorders
+
+    Broadphase _broadphase;
+    SpatialGrid _grid;
+    HierarchicalGrid _hgrid;
+    float _max_radius;
+
+    // broadphase output: compact unordered candidate pairs (i < j), plus per-ball CSR
+    // lists of both orders for COLLIDE_PER_BALL; built per evalF, or once per step
+    // between beginStep and endStep
+    bool _step_context;
+    std::vector<std::pair<int, int>> _pairs;
+    std::vector<int> _neighbor_start;
+    std::vector<int> _neighbors;
+    std::vector<int> _candidates;  // grid query and CSR fill scratch
+
+    CollisionMode _collision_mode;
+    std::vector<std::vector<Vector3f>> _force_buffers;  // one per pool worker
+    std::vector<Vector3f> _pair_forces;
+
+    // per-evalF scratch for the all-walls kernel
+    std::vector<uint32_t> _wall_hits;
+    std::vector<float> _wall_depths;
+
+    int _reorder_interval;  // steps between reorders, 0 disables
+    int _steps_since_reorder;
+    // reorder scratch: sort keys, and the previous per-particle arrays reused
+    // as the gather targets of the next reorder
+    std::vector<std::pair<uint64_t, int>> _reorder_keys;
+    std::vector<Vector3f> _spare_state;
+    std::vector<float> _spare_radii;
+    std::vector<uint16_t> _spare_collided;
+    std::vector<Vector3f> _spare_colors;
+    std::vector<uint32_t> _spare_packed_colors;
+    std::vector<int> _spare_ids;
 };
 
 #endif
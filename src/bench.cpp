@@ -0,0 +1,177 @@
+// Headless collision benchmark. Scatters balls uniformly through a cube (so
+// creation order has no spatial coherence) and times BallSystem::evalF before
+// and after sorting the particle arrays along a Morton curve. Also reports the
+// per-ball memory footprint in full and compact storage.
+//
+// usage: a3_bench [num_particles] [evals] [reorder_interval] [grid|hgrid|all] [mixed] [hugepages] [firsttouch]
+//   mixed: 95% small balls (r = 0.25) and 5% large ones (r = 2)
+//   hugepages, firsttouch: page placement of the large arrays (see largearray.h)
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ballsystem.h"
+#include "integrators.h"
+#include "largearray.h"
+#include "scene.h"
+#include "timestepper.h"
+
+namespace
+{
+
+const float STEP = 0.001f;
+
+Broadphase broadphase = BROADPHASE_GRID;
+bool mixed = false;
+
+double now_s()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void scatter(BallSystem& system, int n)
+{
+    // about one ball per 27 ball volumes, so each one sees a handful of neighbors
+    float side = cbrtf(n * 27.0f) * 0.75f;
+    std::vector<Vector3f> state;
+    state.reserve(2 * n);
+    for (int i=0; i<n; i++) {
+        state.emplace_back(rand_uniform(-side / 2, side / 2), rand_uniform(0, side), rand_uniform(-side / 2, side / 2));
+        state.emplace_back(rand_uniform(-1, 1), rand_uniform(-1, 1), rand_uniform(-1, 1));
+    }
+    system.setState(state);
+
+    system._broadphase = broadphase;
+    if (mixed) {
+        std::vector<float> radii(n);
+        for (int i=0; i<n; i++) {
+            radii[i] = rand_uniform(0, 1) < 0.05f ? 2.0f : 0.25f;
+        }
+        system.setRadii(radii);
+    }
+}
+
+double timeEvalF(BallSystem& system, int evals)
+{
+    std::vector<Vector3f> state = system.getState();
+    system.evalF(state);  // warm up
+    double start = now_s();
+    for (int i=0; i<evals; i++) {
+        system.evalF(state);
+    }
+    return (now_s() - start) / evals;
+}
+
+double timeSteps(BallSystem& system, int steps)
+{
+    RK4 stepper;
+    TimeStepper* ts = &stepper;
+    double start = now_s();
+    for (int i=0; i<steps; i++) {
+        ts->takeStep(&system, STEP);
+    }
+    return (now_s() - start) / steps;
+}
+
+// statically dispatched RK4 in one precision: 'f' float (fused stages), 'g'
+// float through the generic kernel, 'd' double state, 'm' float state with
+// double accumulation
+double timeRk4(BallSystem& system, int steps, char precision)
+{
+    double start = now_s();
+    for (int i=0; i<steps; i++) {
+        switch (precision) {
+        case 'g': rk4GenericStep<BallSystem, float>(system, STEP); break;
+        case 'd': rk4GenericStep<BallSystem, double>(system, STEP); break;
+        case 'm': rk4MixedStep(system, STEP); break;
+        default: rk4Step(system, STEP); break;
+        }
+    }
+    return (now_s() - start) / steps;
+}
+}
+
+int main(int argc, char** argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int evals = argc > 2 ? atoi(argv[2]) : 5;
+    int interval = argc > 3 ? atoi(argv[3]) : 10;
+    if (argc > 4) {
+        broadphase = !strcmp(argv[4], "hgrid") ? BROADPHASE_HIERARCHICAL_GRID :
+                     !strcmp(argv[4], "all") ? BROADPHASE_ALL_PAIRS : BROADPHASE_GRID;
+    }
+    bool huge_pages = false;
+    bool first_touch = false;
+    for (int a=5; a<argc; a++) {
+        mixed = mixed || !strcmp(argv[a], "mixed");
+        huge_pages = huge_pages || !strcmp(argv[a], "hugepages");
+        first_touch = first_touch || !strcmp(argv[a], "firsttouch");
+    }
+    setLargeArrayPolicy(huge_pages, first_touch);
+    printf("%d particles, %d evals, reorder every %d steps\n", n, evals, interval);
+
+    srand(1);
+    BallSystem system(STEP, n);
+    scatter(system, n);
+
+    double creation = timeEvalF(system, evals);
+    printf("evalF, creation order : %8.2f ms  (%.2f M balls/s)\n", creation * 1e3, n / creation * 1e-6);
+
+    system.reorderParticles();
+    double morton = timeEvalF(system, evals);
+    printf("evalF, morton order   : %8.2f ms  (%.2f M balls/s)\n", morton * 1e3, n / morton * 1e-6);
+    printf("speedup               : %8.2fx\n", creation / morton);
+    system.printBroadphaseStats();
+
+    // same start state, stepped with and without the periodic reorder
+    srand(2);
+    BallSystem unsorted(STEP, n);
+    scatter(unsorted, n);
+    unsorted._reorder_interval = 0;
+    srand(2);
+    BallSystem sorted(STEP, n);
+    scatter(sorted, n);
+    sorted._reorder_interval = interval;
+    sorted.reorderParticles();
+
+    double plain = timeSteps(unsorted, evals);
+    double periodic = timeSteps(sorted, evals);
+    printf("RK4 step, no reorder  : %8.2f ms\n", plain * 1e3);
+    printf("RK4 step, reordered   : %8.2f ms\n", periodic * 1e3);
+    sorted.printMemoryFootprint();
+
+    // same again in compact storage
+    srand(2);
+    Scene compact_scene = defaultScene(n);
+    compact_scene.compact_storage = true;
+    BallSystem compact(STEP, compact_scene);
+    scatter(compact, n);
+    compact._reorder_interval = interval;
+    compact.reorderParticles();
+    double compact_step = timeSteps(compact, evals);
+    printf("RK4 step, compact     : %8.2f ms\n", compact_step * 1e3);
+    compact.printMemoryFootprint();
+
+    // precision: same start state stepped in float, double and mixed precision
+    const char precisions[] = {'f', 'g', 'd', 'm'};
+    const char* labels[] = {"float", "float, generic", "double", "mixed"};
+    double float_step = 0;
+    for (int p=0; p<4; p++) {
+        srand(3);
+        BallSystem system_p(STEP, n);
+        scatter(system_p, n);
+        double step = timeRk4(system_p, evals, precisions[p]);
+        if (p == 0) {
+            float_step = step;
+        }
+        printf("RK4 step, %-14s: %8.2f ms  (%.2fx)\n", labels[p], step * 1e3, step / float_step);
+        system_p.stepArena().printStats(labels[p]);
+    }
+    printLargeArrayStats();
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include "checkpoint.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const char CHECKPOINT_MAGIC[8] = {'A', '3', 'C', 'K', 'P', 'T', 0, 0};
+// 2: precise state stored as x, y, z entries; 3: checksum covers the header
+const uint32_t CHECKPOINT_VERSION = 3;
+
+// continues hash over data, so the header and payload chain into one checksum
+static uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for (size_t i=0; i<size; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t checksum(const CheckpointHeader& header, const std::vector<char>& payload)
+{
+    uint64_t hash = fnv1a((const char*)&header, offsetof(CheckpointHeader, checksum));
+    return fnv1a(payload.data(), payload.size(), hash);
+}
+
+// flush a written file to the disk
+static bool syncFile(FILE* f)
+{
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+// make a rename in directory durable (there is no equivalent on Windows)
+static void syncDirectory(const std::string& directory)
+{
+#ifndef _WIN32
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+static std::string directoryOf(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+CheckpointWriter::CheckpointWriter() :
+    _staged_step(0),
+    _pending(false),
+    _quit(false),
+    _busy(false),
+    _written(0)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    stop();
+}
+
+void CheckpointWriter::start(const std::string& path)
+{
+    stop();
+    _path = path;
+    _quit = false;
+    _thread = std::thread(&CheckpointWriter::run, this);
+}
+
+void CheckpointWriter::stop()
+{
+    if (!_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+bool CheckpointWriter::submit(const ParticleSystem& system, long step)
+{
+    if (!isOpen() || _busy.load(std::memory_order_acquire)) {
+        return false;
+    }
+    // the writer only touches _staging while _busy is set, and the staging
+    // buffer keeps its capacity, so this is a single copy of the state
+    _staging.clear();
+    system.saveSnapshot(_staging);
+    _staged_step = step;
+    _busy.store(true, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending = true;
+    }
+    _wake.notify_one();
+    return true;
+}
+
+void CheckpointWriter::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [this]() { return _pending || _quit; });
+        // a staged checkpoint is still written on quit: it is the newest one
+        if (_pending) {
+            _pending = false;
+            lock.unlock();
+            if (write(_staging, _staged_step)) {
+                _written++;
+            }
+            _busy.store(false, std::memory_order_release);
+            lock.lock();
+        } else if (_quit) {
+            return;
+        }
+    }
+}
+
+bool CheckpointWriter::write(const std::vector<char>& payload, uint64_t step)
+{
+    std::string tmp = _path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        printf("Cannot create checkpoint %s\n", tmp.c_str());
+        return false;
+    }
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.step = step;
+    header.payload_size = payload.size();
+    header.checksum = checksum(header, payload);
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(payload.data(), 1, payload.size(), f) == payload.size();
+    // data on disk before the rename makes it visible under the real name
+    ok = ok && fflush(f) == 0 && syncFile(f);
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        printf("Cannot write checkpoint %s\n", tmp.c_str());
+        remove(tmp.c_str());
+        return false;
+    }
+    std::string prev = _path + ".prev";
+    rename(_path.c_str(), prev.c_str());  // fails harmlessly on the first checkpoint
+    if (rename(tmp.c_str(), _path.c_str()) != 0) {
+        printf("Cannot rename checkpoint to %s\n", _path.c_str());
+        return false;
+    }
+    syncDirectory(directoryOf(_path));
+    return true;
+}
+
+// read and verify one checkpoint file, false if missing or damaged
+static bool readCheckpoint(const std::string& path, CheckpointHeader& header, std::vector<char>& payload)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long file_size = ok ? ftell(f) : -1;
+    ok = ok && file_size >= (long)sizeof(header) && fseek(f, 0, SEEK_SET) == 0 &&
+         fread(&header, sizeof(header), 1, f) == 1 &&
+         memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 &&
+         header.version == CHECKPOINT_VERSION &&
+         // checked before anything is allocated for it
+         header.payload_size == (uint64_t)(file_size - (long)sizeof(header));
+    if (ok) {
+        payload.resize(header.payload_size);
+        ok = fread(payload.data(), 1, payload.size(), f) == payload.size() &&
+             checksum(header, payload) == header.checksum;
+    }
+    fclose(f);
+    if (!ok) {
+        printf("Checkpoint %s is damaged, skipping it\n", path.c_str());
+    }
+    return ok;
+}
+
+long loadCheckpoint(const std::string& path, ParticleSystem& system)
+{
+    // the snapshot format has no type information: a checkpoint of this scene
+    // has exactly the size of a snapshot of the freshly set up system, plus
+    // the double state if a double or mixed precision run saved one
+    std::vector<char> probe;
+    system.saveSnapshot(probe);
+    size_t with_precise = probe.size() + system.stateRef().size() * sizeof(Vec3<double>);
+
+    const std::string candidates[2] = {path, path + ".prev"};
+    for (int c=0; c<2; c++) {
+        CheckpointHeader header;
+        std::vector<char> payload;
+        if (!readCheckpoint(candidates[c], header, payload)) {
+            continue;
+        }
+        if (payload.size() != probe.size() && payload.size() != with_precise) {
+            printf("Checkpoint %s was written for a different scene\n", candidates[c].c_str());
+            continue;
+        }
+        const char* in = payload.data();
+        system.loadSnapshot(in);
+        printf("Resumed from %s at step %llu\n", candidates[c].c_str(), (unsigned long long)header.step);
+        return (long)header.step;
+    }
+    printf("No usable checkpoint at %s\n", path.c_str());
+    return -1;
+}
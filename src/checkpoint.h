@@ -0,0 +1,72 @@
+#ifndef A3_CHECKPOINT_H
+#define A3_CHECKPOINT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "particlesystem.h"
+
+/**
+ * Checkpoint file: a fixed header followed by the system's snapshot bytes
+ * (ParticleSystem::saveSnapshot). The checksum covers the header fields before
+ * it and the payload, and the payload size must match the file, so a torn or
+ * corrupted file is recognized and skipped on resume.
+ */
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t step;
+    uint64_t payload_size;
+    uint64_t checksum;  // FNV-1a of the fields above, then the payload
+};
+
+/**
+ * Periodic crash-safe checkpoints written off the simulation thread. submit()
+ * copies the snapshot into a staging buffer at a step boundary and returns;
+ * the writer thread writes it to path.tmp, fsyncs it and renames it over path,
+ * keeping the previous checkpoint as path.prev. A crash at any point leaves at
+ * least one complete checkpoint behind.
+ */
+class CheckpointWriter {
+public:
+    CheckpointWriter();
+    ~CheckpointWriter();  // waits for a write in progress
+
+    void start(const std::string& path);
+    void stop();
+    bool isOpen() const { return _thread.joinable(); }
+
+    // stage system at step for writing, false (and nothing staged) while the
+    // previous checkpoint is still being written
+    bool submit(const ParticleSystem& system, long step);
+
+    long checkpointsWritten() const { return _written; }
+
+private:
+    void run();
+    bool write(const std::vector<char>& payload, uint64_t step);
+
+    std::string _path;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::vector<char> _staging;
+    uint64_t _staged_step;
+    bool _pending;  // _staging holds a checkpoint the writer has not taken yet
+    bool _quit;
+    std::atomic<bool> _busy;  // pending or being written
+    std::atomic<long> _written;
+};
+
+// load the newest valid checkpoint (path, else path.prev) into system, which
+// must have been set up from the same scene; returns its step or -1 if none
+long loadCheckpoint(const std::string& path, ParticleSystem& system);
+
+
+#endif //A3_CHECKPOINT_H
@@ -0,0 +1,222 @@
+#include "exporter.h"
+
+#include <cstdio>
+#include <cstring>
+
+static bool hostIsBigEndian()
+{
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one == 0;
+}
+
+static void append(std::vector<char>& out, const char* text)
+{
+    out.insert(out.end(), text, text + strlen(text));
+}
+
+// legacy VTK binary data is big endian: swap count 4-byte words in place on
+// little endian hosts
+static void toBigEndian(char* data, size_t count)
+{
+    if (hostIsBigEndian()) {
+        return;
+    }
+    for (size_t i=0; i<count; i++, data+=4) {
+        char b0 = data[0], b1 = data[1];
+        data[0] = data[3];
+        data[1] = data[2];
+        data[2] = b1;
+        data[3] = b0;
+    }
+}
+
+static void appendBigEndian(std::vector<char>& out, const void* data, size_t count)
+{
+    size_t start = out.size();
+    out.insert(out.end(), (const char*)data, (const char*)data + 4 * count);
+    toBigEndian(out.data() + start, count);
+}
+
+FrameExporter::FrameExporter() : _format(EXPORT_VTK), _last_step(-1), _quit(false)
+{
+}
+
+FrameExporter::~FrameExporter()
+{
+    stop();
+}
+
+bool FrameExporter::start(const std::string& path)
+{
+    stop();
+    size_t dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+    if (extension == "vtk") {
+        _format = EXPORT_VTK;
+    } else if (extension == "ply") {
+        _format = EXPORT_PLY;
+    } else {
+        printf("Export path %s must end in .vtk or .ply\n", path.c_str());
+        return false;
+    }
+    _prefix = path.substr(0, dot);
+    _last_step = -1;
+    _quit = false;
+    _thread = std::thread(&FrameExporter::run, this);
+    return true;
+}
+
+void FrameExporter::stop()
+{
+    if (!_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+void FrameExporter::submit(const BallSystem& system, long step)
+{
+    if (!isOpen()) {
+        return;
+    }
+    Frame frame;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _room.wait(lock, [this]() { return (int)_queue.size() < QUEUE_DEPTH; });
+        if (!_free.empty()) {
+            frame = std::move(_free.back());
+            _free.pop_back();
+        }
+    }
+
+    // gather by creation index; the vectors keep their capacity between frames
+    const std::vector<Vector3f>& state = system.stateRef();
+    int n = (int)system._ids.size();
+    frame.step = step;
+    frame.position.resize(3 * n);
+    frame.velocity.resize(3 * n);
+    frame.radius.resize(n);
+    frame.color.resize(3 * n);
+    for (int i=0; i<n; i++) {
+        int id = system._ids[i];
+        Vector3f color = system.color(i);
+        for (int k=0; k<3; k++) {
+            frame.position[3*id + k] = state[2*i][k];
+            frame.velocity[3*id + k] = state[2*i + 1][k];
+            float c = color[k];
+            frame.color[3*id + k] = (uint8_t)(c <= 0 ? 0 : c >= 1 ? 255 : c * 255 + 0.5f);
+        }
+        frame.radius[id] = system._radii[i];
+    }
+    _last_step = step;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(std::move(frame));
+    }
+    _wake.notify_one();
+}
+
+void FrameExporter::run()
+{
+    std::vector<char> buffer;  // one whole file, reused
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [this]() { return !_queue.empty() || _quit; });
+        if (_queue.empty()) {
+            return;  // quit once everything queued is written
+        }
+        Frame frame = std::move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+
+        buffer.clear();
+        format(frame, buffer);
+        char name[32];
+        snprintf(name, sizeof(name), "_%06ld.%s", frame.step, _format == EXPORT_VTK ? "vtk" : "ply");
+        std::string path = _prefix + name;
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f || fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size()) {
+            printf("Cannot write %s\n", path.c_str());
+        }
+        if (f) {
+            fclose(f);
+        }
+
+        lock.lock();
+        _free.push_back(std::move(frame));
+        _room.notify_one();
+    }
+}
+
+void FrameExporter::format(const Frame& frame, std::vector<char>& out) const
+{
+    if (_format == EXPORT_VTK) {
+        formatVtk(frame, out);
+    } else {
+        formatPly(frame, out);
+    }
+}
+
+void FrameExporter::formatVtk(const Frame& frame, std::vector<char>& out) const
+{
+    size_t n = frame.radius.size();
+    char line[128];
+    append(out, "# vtk DataFile Version 3.0\n");
+    snprintf(line, sizeof(line), "a3 balls, step %ld\nBINARY\nDATASET POLYDATA\nPOINTS %zu float\n", frame.step, n);
+    append(out, line);
+    appendBigEndian(out, frame.position.data(), 3 * n);
+
+    // one vertex cell per ball so the points render without a glyph filter
+    snprintf(line, sizeof(line), "\nVERTICES %zu %zu\n", n, 2 * n);
+    append(out, line);
+    size_t start = out.size();
+    out.resize(start + 2 * n * sizeof(int32_t));
+    char* cells = out.data() + start;
+    for (size_t i=0; i<n; i++) {
+        int32_t cell[2] = {1, (int32_t)i};
+        memcpy(cells + i * sizeof(cell), cell, sizeof(cell));
+    }
+    toBigEndian(cells, 2 * n);
+
+    snprintf(line, sizeof(line), "\nPOINT_DATA %zu\nVECTORS velocity float\n", n);
+    append(out, line);
+    appendBigEndian(out, frame.velocity.data(), 3 * n);
+    append(out, "\nSCALARS radius float 1\nLOOKUP_TABLE default\n");
+    appendBigEndian(out, frame.radius.data(), n);
+    // binary color scalars are unsigned chars
+    append(out, "\nCOLOR_SCALARS color 3\n");
+    out.insert(out.end(), (const char*)frame.color.data(), (const char*)frame.color.data() + 3 * n);
+    append(out, "\n");
+}
+
+void FrameExporter::formatPly(const Frame& frame, std::vector<char>& out) const
+{
+    size_t n = frame.radius.size();
+    char line[160];
+    snprintf(line, sizeof(line), "ply\nformat %s 1.0\ncomment a3 balls, step %ld\nelement vertex %zu\n",
+             hostIsBigEndian() ? "binary_big_endian" : "binary_little_endian", frame.step, n);
+    append(out, line);
+    append(out, "property float x\nproperty float y\nproperty float z\n"
+                "property float vx\nproperty float vy\nproperty float vz\n"
+                "property float radius\n"
+                "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+                "end_header\n");
+
+    // interleaved, 31 bytes per vertex
+    const size_t stride = 7 * sizeof(float) + 3;
+    size_t start = out.size();
+    out.resize(start + stride * n);
+    char* dst = out.data() + start;
+    for (size_t i=0; i<n; i++, dst+=stride) {
+        memcpy(dst, &frame.position[3*i], 3 * sizeof(float));
+        memcpy(dst + 12, &frame.velocity[3*i], 3 * sizeof(float));
+        memcpy(dst + 24, &frame.radius[i], sizeof(float));
+        memcpy(dst + 28, &frame.color[3*i], 3);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef A3_EXPORTER_H
+#define A3_EXPORTER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ballsystem.h"
+
+enum ExportFormat {
+    EXPORT_VTK,  // legacy VTK PolyData, binary (big endian as the format requires)
+    EXPORT_PLY  // PLY point cloud, binary in host byte order
+};
+
+/**
+ * Writes ball frames as point clouds for offline tools like ParaView: one
+ * file per frame with position, velocity, radius and color per ball, in
+ * creation order (BallSystem::_ids) so a ball keeps its index across frames.
+ * submit() only gathers the frame; a writer thread formats it into one buffer
+ * and writes that with a single fwrite. Up to QUEUE_DEPTH frames can wait,
+ * beyond that submit blocks rather than dropping frames.
+ */
+class FrameExporter {
+public:
+    static const int QUEUE_DEPTH = 4;
+
+    FrameExporter();
+    ~FrameExporter();  // writes the frames still queued
+
+    // path like out/frame.vtk or out/frame.ply: frames go to out/frame_<step>.vtk,
+    // the extension picks the format; false for other extensions
+    bool start(const std::string& path);
+    void stop();
+    bool isOpen() const { return _thread.joinable(); }
+
+    void submit(const BallSystem& system, long step);
+
+    long lastStep() const { return _last_step; }  // -1 before the first submit
+
+private:
+    struct Frame {
+        long step;
+        std::vector<float> position;  // x, y, z per ball
+        std::vector<float> velocity;
+        std::vector<float> radius;
+        std::vector<uint8_t> color;  // r, g, b per ball
+    };
+
+    void run();
+    void format(const Frame& frame, std::vector<char>& out) const;
+    void formatVtk(const Frame& frame, std::vector<char>& out) const;
+    void formatPly(const Frame& frame, std::vector<char>& out) const;
+
+    std::string _prefix;
+    ExportFormat _format;
+    long _last_step;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;  // writer: a frame was queued or stop
+    std::condition_variable _room;  // submit: a frame was written
+    std::deque<Frame> _queue;
+    std::vector<Frame> _free;  // written frames, reused so steady state allocates nothing
+    bool _quit;
+};
+
+
+#endif //A3_EXPORTER_H
@@ -0,0 +1,88 @@
+#include "hierarchicalgrid.h"
+
+#include <cmath>
+#include <cstdio>
+
+const int MAX_LEVELS = 16;
+
+HierarchicalGrid::HierarchicalGrid() {
+}
+
+void HierarchicalGrid::build(const SphereSet& spheres, float slack) {
+    // levels and member lists keep their storage from the last build; levels
+    // no ball falls into stay empty
+    for (std::vector<int>& members : _members) {
+        members.clear();
+    }
+    if (spheres.count == 0) {
+        return;
+    }
+
+    float min_radius = spheres.radius[0];
+    for (int i=0; i<spheres.count; i++) {
+        min_radius = fminf(min_radius, spheres.radius[i]);
+    }
+    float base = 2 * min_radius + slack;
+
+    // finest level l with 2r + slack <= base * 2^l
+    for (int i=0; i<spheres.count; i++) {
+        int level = 0;
+        float cell = base;
+        while (2 * spheres.radius[i] + slack > cell && level < MAX_LEVELS - 1) {
+            cell *= 2;
+            level += 1;
+        }
+        if (level >= (int)_members.size()) {
+            _members.resize(level + 1);
+        }
+        _members[level].push_back(i);
+    }
+
+    _levels.resize(_members.size());
+    float cell = base;
+    for (size_t l=0; l<_levels.size(); l++) {
+        _levels[l].build(spheres, _members[l].data(), (int)_members[l].size(), cell);
+        cell *= 2;
+    }
+}
+
+void HierarchicalGrid::findPairs(const SphereSet& spheres, std::vector<std::pair<int, int>>& pairs) {
+    std::vector<int>& candidates = _candidates;
+    for (size_t a=0; a<_levels.size(); a++) {
+        for (int i : _members[a]) {
+            // a pair's reach is at most the coarser level's cell, so the 27-cell query there finds it
+            for (size_t b=a; b<_levels.size(); b++) {
+                if (_members[b].empty()) {
+                    continue;
+                }
+                candidates.clear();
+                _levels[b].query(spheres.center(i), candidates);
+                for (int j : candidates) {
+                    if (b == a && j <= i) {
+                        continue;  // same level pairs are seen from both ends
+                    }
+                    pairs.emplace_back(std::min(i, j), std::max(i, j));
+                }
+            }
+        }
+    }
+}
+
+size_t HierarchicalGrid::memoryBytes() const {
+    size_t bytes = _candidates.capacity() * sizeof(int);
+    for (size_t l=0; l<_levels.size(); l++) {
+        bytes += _levels[l].memoryBytes() + _members[l].capacity() * sizeof(int);
+    }
+    return bytes;
+}
+
+void HierarchicalGrid::printStats() const {
+    for (size_t l=0; l<_levels.size(); l++) {
+        if (_members[l].empty()) {
+            continue;
+        }
+        printf("level %2d: cell %8.3f  balls %9d  occupied buckets %9d  max bucket %4d\n",
+               (int)l, _levels[l].cellSize(), (int)_members[l].size(),
+               _levels[l].occupiedBuckets(), _levels[l].maxBucketLoad());
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef A3_HIERARCHICALGRID_H
+#define A3_HIERARCHICALGRID_H
+
+#include <utility>
+#include <vector>
+
+#include "spatialgrid.h"
+
+/**
+ * Stack of hash grids whose cell size doubles per level. Each sphere lives on
+ * the finest level whose cells fit its contact reach, so small balls are not
+ * tested against a grid sized for the biggest one. A sphere only queries its
+ * own level and coarser ones; the coarser ball of a pair is always found there.
+ */
+class HierarchicalGrid {
+public:
+    HierarchicalGrid();
+
+    // slack is added to every ball's diameter (contact tolerance plus any motion margin)
+    void build(const SphereSet& spheres, float slack);
+
+    // append each unordered pair (i < j) in neighboring cells of the coarser ball's level
+    void findPairs(const SphereSet& spheres, std::vector<std::pair<int, int>>& pairs);
+
+    // per level: cell size, balls, occupied buckets, fullest bucket
+    void printStats() const;
+
+    int numLevels() const { return (int)_levels.size(); }
+    // heap bytes held by all levels and member lists
+    size_t memoryBytes() const;
+
+private:
+    std::vector<SpatialGrid> _levels;
+    std::vector<std::vector<int>> _members;  // sphere indices per level
+    std::vector<int> _candidates;  // findPairs scratch
+};
+
+
+#endif //A3_HIERARCHICALGRID_H
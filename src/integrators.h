@@ -0,0 +1,247 @@
+#ifndef A3_INTEGRATORS_H
+#define A3_INTEGRATORS_H
+
+#include <vector>
+#include <vecmath.h>
+
+#include "largearray.h"
+#include "timestepper.h"
+#include "vec3.h"
+
+// Integrator kernels templated on the concrete system type. With a final
+// system class (BallSystem, SpringSystem) every evalF/beginStep/endStep call
+// below is devirtualized and can be inlined into the stage loops; with
+// System = ParticleSystem they are the plain virtual steppers. Temporaries
+// come from the system's step arena, reset at the start of each step; the
+// current state is read in place and the new one written to a back buffer.
+//
+// The plain kernels are also templated on the scalar type T of the state they
+// integrate (see StepState). evalF always runs in float on the rounded state;
+// with T = double the state, the stage states and the sums stay in double.
+//
+// The loops over the state go through parallelForLarge, so with first touch on
+// each worker streams the chunk of the buffers it placed.
+
+// Where a stepper over scalar T keeps the state: float steps the system's own
+// state, double its preciseState() copy, rounded to float for every evalF and
+// into the system's state at the end of the step
+template <typename T>
+struct StepState;
+
+template <>
+struct StepState<float>
+{
+    typedef Vector3f Vec;
+    static const std::vector<Vector3f>& current(ParticleSystem& system) { return system.stateRef(); }
+    static std::vector<Vector3f>& next(ParticleSystem& system) { return system.nextState(); }
+    static void commit(ParticleSystem& system) { system.swapState(); }
+    static std::vector<Vector3f>& take(StepArena& arena, size_t n) { return arena.take(n); }
+    static const Vector3f& widen(const Vector3f& f) { return f; }
+    static const Vector3f& narrow(const Vector3f& v) { return v; }
+    // x as evalF input, no copy
+    static const std::vector<Vector3f>& evalInput(const std::vector<Vector3f>& x, StepArena&) { return x; }
+};
+
+template <>
+struct StepState<double>
+{
+    typedef Vec3<double> Vec;
+    static const std::vector<Vec>& current(ParticleSystem& system) { return system.preciseState(); }
+    static std::vector<Vec>& next(ParticleSystem& system) { return system.nextPreciseState(); }
+    static void commit(ParticleSystem& system) { system.swapPreciseState(); }
+    static std::vector<Vec>& take(StepArena& arena, size_t n) { return arena.takeWide(n); }
+    static Vec widen(const Vector3f& f) { return Vec(f); }
+    static Vector3f narrow(const Vec& v) { return v.toFloat(); }
+    // x rounded into an arena buffer
+    static const std::vector<Vector3f>& evalInput(const std::vector<Vec>& x, StepArena& arena)
+    {
+        std::vector<Vector3f>& rounded = arena.take(x.size());
+        parallelForLarge((int)x.size(), sizeof(Vec), [&](int begin, int end) {
+            for (int i=begin; i<end; i++) {
+                rounded[i] = x[i].toFloat();
+            }
+        });
+        return rounded;
+    }
+};
+
+template <class System, typename T = float>
+void forwardEulerStep(System& system, float stepSize)
+{
+    typedef StepState<T> S;
+    typedef typename S::Vec Vec;
+    StepArena& arena = system.stepArena();
+    arena.reset();
+    system.beginStep(stepSize);
+    const std::vector<Vec>& current = S::current(system);
+    std::vector<Vector3f>& derivatives = arena.take(current.size());
+    system.evalFInto(S::evalInput(current, arena), derivatives);
+
+    std::vector<Vec>& updated = S::next(system);
+    T h = stepSize;
+    parallelForLarge((int)current.size(), sizeof(Vec), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            // z is carried over unchanged, as in the original stepper
+            updated[i] = Vec(current[i][0] + h * derivatives[i][0],
+                             current[i][1] + h * derivatives[i][1],
+                             current[i][2]);
+        }
+    });
+    S::commit(system);
+    system.endStep();
+}
+
+template <class System, typename T = float>
+void trapezoidalStep(System& system, float stepSize)
+{
+    typedef StepState<T> S;
+    typedef typename S::Vec Vec;
+    StepArena& arena = system.stepArena();
+    arena.reset();
+    system.beginStep(stepSize);
+    const std::vector<Vec>& current = S::current(system);
+    std::vector<Vector3f>& f0 = arena.take(current.size());
+    system.evalFInto(S::evalInput(current, arena), f0);
+
+    T h = stepSize;
+    std::vector<Vec>& stepped = S::take(arena, current.size());
+    parallelForLarge((int)current.size(), sizeof(Vec), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            stepped[i] = Vec(current[i][0] + h * f0[i][0],
+                             current[i][1] + h * f0[i][1],
+                             current[i][2]);
+        }
+    });
+    std::vector<Vector3f>& f1 = arena.take(current.size());
+    system.evalFInto(S::evalInput(stepped, arena), f1);
+
+    std::vector<Vec>& updated = S::next(system);
+    parallelForLarge((int)current.size(), sizeof(Vec), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            // f1[0], not f1[i], as in the original stepper
+            updated[i] = current[i] + (S::widen(f0[i]) + S::widen(f1[0])) * h / T(2);
+        }
+    });
+    S::commit(system);
+    system.endStep();
+}
+
+// classic RK4 over scalar T with every stage state materialized. for float
+// it computes the same numbers as the fused rk4Step below, which is what the
+// float integrators use; double runs through this one
+template <class System, typename T>
+void rk4GenericStep(System& system, float stepSize)
+{
+    typedef StepState<T> S;
+    typedef typename S::Vec Vec;
+    StepArena& arena = system.stepArena();
+    arena.reset();
+    system.beginStep(stepSize);
+    const std::vector<Vec>& current = S::current(system);
+    size_t n = current.size();
+    std::vector<Vec>& sum = S::take(arena, n);
+    std::vector<Vector3f>& stage = arena.take(n);
+    std::vector<Vector3f>& k = arena.take(n);
+
+    T h = stepSize;
+    const T a[4] = {0, h / 2, h / 2, h};
+    const T w[4] = {1, 2, 2, 1};
+    system.evalFInto(S::evalInput(current, arena), k);
+    for (int s=0; s<4; s++) {
+        if (s > 0) {
+            parallelForLarge((int)n, sizeof(Vec), [&](int begin, int end) {
+                for (int i=begin; i<end; i++) {
+                    stage[i] = S::narrow(current[i] + a[s] * S::widen(k[i]));
+                }
+            });
+            system.evalFInto(stage, k);
+        }
+        parallelForLarge((int)n, sizeof(Vec), [&](int begin, int end) {
+            for (int i=begin; i<end; i++) {
+                sum[i] = s == 0 ? w[s] * S::widen(k[i]) : sum[i] + w[s] * S::widen(k[i]);
+            }
+        });
+    }
+
+    std::vector<Vec>& updated = S::next(system);
+    T scale = h / 6;
+    parallelForLarge((int)n, sizeof(Vec), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            updated[i] = current[i] + scale * sum[i];
+        }
+    });
+    S::commit(system);
+    system.endStep();
+}
+
+// fused RK4 stages: every stage state is formed inside the system's evalFStage
+// and the k1 + 2 k2 + 2 k3 + k4 sum is accumulated as each stage is evaluated,
+// so only two derivative buffers and the sum are live besides the state itself
+template <class System>
+void rk4Stages(System& system, float stepSize, std::vector<Vector3f>& sum)
+{
+    StepArena& arena = system.stepArena();
+    std::vector<Vector3f>& ka = arena.take(sum.size());
+    std::vector<Vector3f>& kb = arena.take(sum.size());
+    system.evalFStage(0, kb, ka, sum, 1, false);
+    system.evalFStage(stepSize/2, ka, kb, sum, 2, true);
+    system.evalFStage(stepSize/2, kb, ka, sum, 2, true);
+    system.evalFStage(stepSize, ka, kb, sum, 1, true);
+}
+
+template <class System>
+void rk4Step(System& system, float stepSize)
+{
+    StepArena& arena = system.stepArena();
+    arena.reset();
+    system.beginStep(stepSize);
+    std::vector<Vector3f>& sum = arena.take(system.stateRef().size());
+    rk4Stages(system, stepSize, sum);
+    system.advanceState(sum, stepSize / 6);
+    system.endStep();
+}
+
+// mixed precision RK4: stages are evaluated on the float state, the step is
+// accumulated into the system's double copy of it
+template <class System>
+void rk4MixedStep(System& system, float stepSize)
+{
+    StepArena& arena = system.stepArena();
+    arena.reset();
+    system.beginStep(stepSize);
+    std::vector<Vector3f>& sum = arena.take(system.stateRef().size());
+    rk4Stages(system, stepSize, sum);
+    system.advanceStateMixed(sum, (double)stepSize / 6);
+    system.endStep();
+}
+
+
+// Runtime-polymorphic wrapper around one kernel instantiation, so main can keep
+// picking integrators by letter while the step itself is statically bound.
+template <class System, void (*Step)(System&, float)>
+class StaticStepper : public TimeStepper
+{
+public:
+    void takeStep(ParticleSystem* particleSystem, float stepSize) override
+    {
+        Step(*static_cast<System*>(particleSystem), stepSize);
+    }
+};
+
+// 'e', 't', 'r', 'm' (mixed precision RK4) or 'd' (double RK4) specialized
+// for System, nullptr for any other letter
+template <class System>
+TimeStepper* makeStaticStepper(char integrator)
+{
+    switch (integrator) {
+    case 'e': return new StaticStepper<System, forwardEulerStep<System>>();
+    case 't': return new StaticStepper<System, trapezoidalStep<System>>();
+    case 'r': return new StaticStepper<System, rk4Step<System>>();
+    case 'm': return new StaticStepper<System, rk4MixedStep<System>>();
+    case 'd': return new StaticStepper<System, rk4GenericStep<System, double>>();
+    default: return nullptr;
+    }
+}
+
+
+#endif //A3_INTEGRATORS_H
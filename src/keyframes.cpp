@@ -0,0 +1,138 @@
+#include "keyframes.h"
+
+#include <cassert>
+
+// runs shorter than this are cheaper as literals
+const int MIN_RUN = 3;
+const int MAX_RUN = 130;
+const int MAX_LITERAL = 128;
+
+void packBytes(const std::vector<char>& raw, std::vector<uint8_t>& packed)
+{
+    // shuffle: plane b holds byte b of every word, the tail is copied as is
+    size_t words = raw.size() / 4;
+    std::vector<uint8_t> planes(raw.size());
+    for (size_t w=0; w<words; w++) {
+        for (int b=0; b<4; b++) {
+            planes[b * words + w] = (uint8_t)raw[4 * w + b];
+        }
+    }
+    for (size_t i=4 * words; i<raw.size(); i++) {
+        planes[i] = (uint8_t)raw[i];
+    }
+
+    // control byte c < 128: c + 1 literal bytes follow; c >= 128: the next byte
+    // repeats c - 125 times
+    packed.clear();
+    size_t n = planes.size();
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < MAX_RUN && planes[i + run] == planes[i]) {
+            run++;
+        }
+        if (run >= MIN_RUN) {
+            packed.push_back((uint8_t)(run - MIN_RUN + 128));
+            packed.push_back(planes[i]);
+            i += run;
+            continue;
+        }
+        // literals up to the next run worth coding
+        size_t start = i;
+        while (i < n && i - start < MAX_LITERAL) {
+            if (i + 2 < n && planes[i] == planes[i + 1] && planes[i] == planes[i + 2]) {
+                break;
+            }
+            i++;
+        }
+        packed.push_back((uint8_t)(i - start - 1));
+        packed.insert(packed.end(), planes.begin() + start, planes.begin() + i);
+    }
+}
+
+void unpackBytes(const std::vector<uint8_t>& packed, size_t raw_size, std::vector<char>& raw)
+{
+    std::vector<uint8_t> planes;
+    planes.reserve(raw_size);
+    size_t i = 0;
+    while (i < packed.size()) {
+        int c = packed[i++];
+        if (c >= 128) {
+            planes.insert(planes.end(), c - 128 + MIN_RUN, packed[i++]);
+        } else {
+            planes.insert(planes.end(), packed.begin() + i, packed.begin() + i + c + 1);
+            i += c + 1;
+        }
+    }
+    assert(planes.size() == raw_size);
+
+    size_t words = raw_size / 4;
+    raw.resize(raw_size);
+    for (size_t w=0; w<words; w++) {
+        for (int b=0; b<4; b++) {
+            raw[4 * w + b] = (char)planes[b * words + w];
+        }
+    }
+    for (size_t k=4 * words; k<raw_size; k++) {
+        raw[k] = (char)planes[k];
+    }
+}
+
+
+KeyframeBuffer::KeyframeBuffer(size_t budget_bytes, int interval) :
+    _budget(budget_bytes),
+    _used(0),
+    _raw(0),
+    _interval(interval > 0 ? interval : 1)
+{
+}
+
+void KeyframeBuffer::clear()
+{
+    _frames.clear();
+    _used = 0;
+    _raw = 0;
+}
+
+void KeyframeBuffer::record(long step, const ParticleSystem& system)
+{
+    while (!_frames.empty() && _frames.back().step >= step) {
+        _used -= _frames.back().packed.size();
+        _raw -= _frames.back().raw_size;
+        _frames.pop_back();
+    }
+
+    std::vector<char> raw;
+    system.saveSnapshot(raw);
+    Keyframe frame;
+    frame.step = step;
+    frame.raw_size = raw.size();
+    packBytes(raw, frame.packed);
+    _used += frame.packed.size();
+    _raw += frame.raw_size;
+    _frames.push_back(frame);
+
+    // the newest keyframe is always kept, even if it alone is over budget
+    while (_used > _budget && _frames.size() > 1) {
+        _used -= _frames.front().packed.size();
+        _raw -= _frames.front().raw_size;
+        _frames.pop_front();
+    }
+}
+
+long KeyframeBuffer::restore(long step, ParticleSystem& system) const
+{
+    // frames are sorted by step: last one not after the target
+    for (int i=(int)_frames.size() - 1; i>=0; i--) {
+        const Keyframe& frame = _frames[i];
+        if (frame.step <= step) {
+            std::vector<char> raw;
+            unpackBytes(frame.packed, frame.raw_size, raw);
+            const char* in = raw.data();
+            system.loadSnapshot(in);
+            assert(in == raw.data() + raw.size());
+            return frame.step;
+        }
+    }
+    return -1;
+}
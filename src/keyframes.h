@@ -0,0 +1,55 @@
+#ifndef A3_KEYFRAMES_H
+#define A3_KEYFRAMES_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "particlesystem.h"
+
+// byte-shuffled (one plane per byte of every 4-byte word) then run-length coded:
+// float exponents and sign bytes of neighboring particles line up into runs
+void packBytes(const std::vector<char>& raw, std::vector<uint8_t>& packed);
+void unpackBytes(const std::vector<uint8_t>& packed, size_t raw_size, std::vector<char>& raw);
+
+/**
+ * Compressed system snapshots taken every few steps, oldest dropped first once
+ * the budget is used up. Seeking loads the latest keyframe at or before the
+ * target step; the caller re-simulates the remaining steps, which reproduces
+ * the original run exactly because snapshots carry all evolving state.
+ */
+class KeyframeBuffer {
+public:
+    KeyframeBuffer(size_t budget_bytes, int interval);
+
+    int interval() const { return _interval; }
+    void clear();
+
+    // snapshot for step; keyframes after it (left over from before a seek) are dropped
+    void record(long step, const ParticleSystem& system);
+
+    // load the latest keyframe at or before step into system, returns its step or -1 if none
+    long restore(long step, ParticleSystem& system) const;
+
+    long oldestStep() const { return _frames.empty() ? -1 : _frames.front().step; }
+    long newestStep() const { return _frames.empty() ? -1 : _frames.back().step; }
+    int size() const { return (int)_frames.size(); }
+    size_t bytesUsed() const { return _used; }
+    size_t rawBytes() const { return _raw; }
+
+private:
+    struct Keyframe {
+        long step;
+        size_t raw_size;
+        std::vector<uint8_t> packed;
+    };
+
+    std::deque<Keyframe> _frames;  // increasing step
+    size_t _budget;
+    size_t _used;  // packed bytes held
+    size_t _raw;  // what they would take uncompressed
+    int _interval;
+};
+
+
+#endif //A3_KEYFRAMES_H
@@ -0,0 +1,167 @@
+#include "largearray.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "threadpool.h"
+
+namespace
+{
+bool huge_pages = false;
+bool first_touch = false;
+std::atomic<long> placed_arrays(0);
+std::atomic<long long> placed_bytes(0);
+std::atomic<long long> resident_bytes(0);  // already touched when placed
+bool advise_failed = false;
+
+size_t pageSize()
+{
+#ifdef _WIN32
+    return 4096;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// first line of a sysfs or procfs file that starts with prefix, empty if none
+std::string readLine(const char* path, const char* prefix)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return std::string();
+    }
+    char line[256];
+    std::string found;
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, prefix, strlen(prefix))) {
+            found = line;
+            while (!found.empty() && (found.back() == '\n' || found.back() == ' ')) {
+                found.pop_back();
+            }
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// bytes of the pages under [data, data + bytes) that are already resident;
+// advice and first touch no longer move those. All of them if unknown
+size_t residentBytes(void* data, size_t bytes, size_t page)
+{
+#ifdef _WIN32
+    return bytes;
+#else
+    uintptr_t begin = (uintptr_t)data & ~(uintptr_t)(page - 1);
+    uintptr_t end = (uintptr_t)data + bytes;
+    std::vector<unsigned char> pages((end - begin + page - 1) / page);
+    if (mincore((void*)begin, end - begin, pages.data()) != 0) {
+        return bytes;
+    }
+    size_t resident = 0;
+    for (size_t p=0; p<pages.size(); p++) {
+        if (pages[p] & 1) {
+            // only the part of the page inside the array
+            uintptr_t lo = std::max(begin + p * page, (uintptr_t)data);
+            uintptr_t hi = std::min(begin + (p + 1) * page, end);
+            resident += hi - lo;
+        }
+    }
+    return resident;
+#endif
+}
+}
+
+void setLargeArrayPolicy(bool huge, bool touch)
+{
+    huge_pages = huge;
+    first_touch = touch;
+#ifdef __GLIBC__
+    if (huge_pages || first_touch) {
+        // a fixed threshold (the default one rises as large blocks are freed)
+        // keeps every large array on its own fresh mapping, never on heap
+        // pages an earlier allocation already touched
+        mallopt(M_MMAP_THRESHOLD, (int)LARGE_ARRAY_BYTES);
+    }
+#endif
+}
+
+bool largeArrayPlacement()
+{
+    return huge_pages || first_touch;
+}
+
+void placeLargeArray(void* data, size_t bytes)
+{
+    size_t page = pageSize();
+    size_t resident = residentBytes(data, bytes, page);
+#if defined(MADV_HUGEPAGE)
+    if (huge_pages) {
+        // madvise wants whole pages; the partial pages at either end stay as they are
+        uintptr_t begin = ((uintptr_t)data + page - 1) & ~(uintptr_t)(page - 1);
+        uintptr_t end = ((uintptr_t)data + bytes) & ~(uintptr_t)(page - 1);
+        if (end > begin && madvise((void*)begin, end - begin, MADV_HUGEPAGE) != 0 && !advise_failed) {
+            printf("Huge pages not available (madvise failed), using normal pages\n");
+            advise_failed = true;
+        }
+    }
+#else
+    if (huge_pages && !advise_failed) {
+        printf("Huge pages are not supported on this platform\n");
+        advise_failed = true;
+    }
+#endif
+    if (first_touch) {
+        // one write per page, from the worker whose chunk the page falls in
+        char* base = (char*)data;
+        int pages = (int)((bytes + page - 1) / page);
+        ThreadPool::shared().parallelFor(pages, [&](int worker, int begin, int end) {
+            for (int p=begin; p<end; p++) {
+                base[(size_t)p * page] = 0;
+            }
+        });
+    }
+    placed_arrays++;
+    placed_bytes += bytes - resident;
+    resident_bytes += resident;
+}
+
+void parallelForLarge(int count, size_t entry_bytes, const std::function<void(int, int)>& fn)
+{
+    if (!first_touch || (size_t)count * entry_bytes < LARGE_ARRAY_BYTES) {
+        if (count > 0) {
+            fn(0, count);
+        }
+        return;
+    }
+    ThreadPool::shared().parallelFor(count, [&](int worker, int begin, int end) {
+        fn(begin, end);
+    });
+}
+
+void printLargeArrayStats()
+{
+    printf("large arrays: huge pages %s, first touch %s (%d workers), %ld arrays, %.1f MB placed, %.1f MB already resident\n",
+           huge_pages ? "on" : "off", first_touch ? "on" : "off", ThreadPool::shared().size(),
+           placed_arrays.load(), placed_bytes.load() / 1048576.0, resident_bytes.load() / 1048576.0);
+    std::string thp = readLine("/sys/kernel/mm/transparent_hugepage/enabled", "");
+    if (!thp.empty()) {
+        printf("  transparent huge pages: %s\n", thp.c_str());
+    }
+    std::string anon = readLine("/proc/self/smaps_rollup", "AnonHugePages:");
+    if (!anon.empty()) {
+        printf("  %s\n", anon.c_str());
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef A3_LARGEARRAY_H
+#define A3_LARGEARRAY_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+ * Page placement for the big per-particle arrays (state, step arena buffers,
+ * per-ball scratch). Storage of at least LARGE_ARRAY_BYTES can be advised onto
+ * transparent huge pages, and first touched by the ThreadPool before anything
+ * is written to it, so each worker's parallelFor chunk of the array lands on
+ * that worker's NUMA node. Chunks are proportional to the index, so the same
+ * split holds for per-ball and per-state-entry arrays, and the loops streaming
+ * through these arrays run on the same chunks (parallelForLarge). Both are off
+ * by default.
+ *
+ * With placement on, malloc is told to map every allocation of that size
+ * freshly (glibc's mmap threshold), so the pages are still untouched when
+ * they are placed; pages that were already resident are left where they are
+ * and not counted as placed.
+ */
+const size_t LARGE_ARRAY_BYTES = 4 << 20;
+
+void setLargeArrayPolicy(bool huge_pages, bool first_touch);
+bool largeArrayPlacement();  // either option on
+
+// advise and first touch fresh storage [data, data + bytes)
+void placeLargeArray(void* data, size_t bytes);
+
+// run fn(begin, end) over [0, count) split across ThreadPool::shared() like
+// the first touch was, when first touch is on and count entries of entry_bytes
+// make a large array; otherwise in one call on this thread. fn must only write
+// entries in its own range, so results don't depend on the split
+void parallelForLarge(int count, size_t entry_bytes, const std::function<void(int, int)>& fn);
+
+// policy, bytes placed so far, and the kernel's huge page settings and usage
+void printLargeArrayStats();
+
+// make room for n entries in v, placing new storage if it is large; entries
+// are kept. With placement off this does nothing, resize allocates as usual
+template <typename T>
+void reserveLargeArray(std::vector<T>& v, size_t n)
+{
+    if (v.capacity() >= n || n * sizeof(T) < LARGE_ARRAY_BYTES || !largeArrayPlacement()) {
+        return;
+    }
+    std::vector<T> placed;
+    placed.reserve(n);
+    placeLargeArray(placed.data(), n * sizeof(T));
+    placed.insert(placed.end(), v.begin(), v.end());
+    v.swap(placed);
+}
+
+
+#endif //A3_LARGEARRAY_H
@@ -1,17 +1,30 @@
 #include "gl.h"
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "vertexrecorder.h"
 #include "starter3_util.h"
 #include "camera.h"
 #include "timestepper.h"
+#include "integrators.h"
 #include "ballsystem.h"
+#include "springsystem.h"
+#include "keyframes.h"
+#include "scene.h"
+#include "trajectory.h"
+#include "sharedstate.h"
+#include "checkpoint.h"
+#include "exporter.h"
+#include "telemetry.h"
+#include "largearray.h"
 
 using namespace std;
 
@@ -21,6 +34,8 @@ namespace
 // Declarations of functions whose implementations occur later.
 void initSystem(float stepsize);
 void stepSystem();
+void advanceStep();
+void seekStep(long target);
 void drawSystem();
 void freeSystem();
 void resetTime();
@@ -31,6 +46,15 @@ void drawAxis();
 // Some constants
 const Vector3f LIGHT_POS(0.0f, 4.0f, 3.0f);
 const Vector3f LIGHT_COLOR(120.0f, 120.0f, 120.0f);
+// rewind keyframes: steps between them and the default memory cap
+const int KEYFRAME_INTERVAL = 30;
+const int KEYFRAME_MB = 64;
+// --record writes a trajectory frame about this often in simulated time
+const float RECORD_FRAME_S = 1.0f / 60;
+// --checkpoint saves the system about this often in wall clock time
+const double CHECKPOINT_S = 60;
+// --export writes a frame every this many steps unless --export-stride says otherwise
+const int EXPORT_STRIDE = 10;
 
 // time keeping
 // current "tick" (e.g. clock number of processor)
@@ -44,13 +68,49 @@ double simulated_s;
 TimeStepper* timeStepper;
 float h;
 char integrator;
+std::string scene = "balls";
+Scene* scene_file;  // --scene, built into a BallSystem on every reset
 
 Camera camera;
 bool gMousePressed = false;
 GLuint program_color;
 GLuint program_light;
 
-BallSystem* pendulumSystem;
+ParticleSystem* pendulumSystem;
+
+// rewind / scrub state
+KeyframeBuffer* keyframes;
+long step_count;
+bool paused = false;
+
+// trajectory recording (--record) and playback (--replay)
+std::string record_path;
+TrajectoryWriter recorder;
+int record_interval;  // steps per recorded frame
+long record_first_step;  // step of the first recorded frame, nonzero after --resume
+bool replaying = false;
+TrajectoryReader replay;
+double replay_s;
+bool replay_cubic = true;
+
+// live state export (--shm), published after every step
+std::string shm_name;
+SharedStateWriter shared_state;
+const std::vector<int>* shared_ids;  // particle ids for systems that reorder
+
+// crash recovery (--checkpoint, --resume)
+std::string checkpoint_path;
+bool resume = false;
+CheckpointWriter checkpoints;
+double next_checkpoint_s;
+
+// point cloud export for offline tools (--export, --export-stride)
+std::string export_path;
+int export_stride = EXPORT_STRIDE;
+FrameExporter exporter;
+
+// stats socket for operators (--telemetry), published once per frame
+TelemetryServer telemetry;
 
 // Function implementations
 static void keyCallback(GLFWwindow* window, int key,
@@ -81,6 +141,52 @@ static void keyCallback(GLFWwindow* window, int key,
         resetTime();
         break;
     }
+    case 'P':
+    {
+        paused = !paused;
+        if (replaying) {
+            printf("%s at %.3f s\n", paused ? "Paused" : "Playing", replay_s);
+        } else {
+            printf("%s at step %ld\n", paused ? "Paused" : "Running", step_count);
+        }
+        break;
+    }
+    case ',':  // step back
+    {
+        paused = true;
+        if (replaying) {
+            replay_s = fmax(replay_s - replay.frameDt(), 0.0);
+        } else {
+            seekStep(step_count - 1);
+        }
+        break;
+    }
+    case '.':  // step forward
+    {
+        paused = true;
+        if (replaying) {
+            replay_s = fmin(replay_s + replay.frameDt(), replay.duration());
+        } else {
+            advanceStep();
+            printf("Step %ld\n", step_count);
+        }
+        break;
+    }
+    case 'I':
+    {
+        replay_cubic = !replay_cubic;
+        printf("%s replay interpolation\n", replay_cubic ? "Cubic" : "Linear");
+        break;
+    }
+    case 'M':
+    {
+        BallSystem* balls = dynamic_cast<BallSystem*>(pendulumSystem);
+        if (balls) {
+            balls->printMemoryFootprint();
+        }
+        printLargeArrayStats();
+        break;
+    }
 
     default:
         cout << "Unhandled key press " << key << "." << endl;
@@ -150,7 +256,7 @@ void drawAxis()
     const Vector3f AXISY(0, 5, 0);
     const Vector3f AXISZ(0, 0, 5);
 
-    VertexRecorder recorder;
+    VertexRecorder recorder(12);
     recorder.record_poscolor(ORGN, DKRED);
     recorder.record_poscolor(AXISX, DKRED);
     recorder.record_poscolor(ORGN, DKGREEN);
@@ -173,14 +279,78 @@ void drawAxis()
 // initialize your particle systems
 void initSystem(float stepsize)
 {
-    switch (integrator) {
-    case 'e': timeStepper = new ForwardEuler(); break;
-    case 't': timeStepper = new Trapezoidal(); break;
-    case 'r': timeStepper = new RK4(); break;
-    default: printf("Unrecognized integrator\n"); exit(-1);
+    if (replaying) {
+        // playback only, nothing is stepped
+        pendulumSystem = replay.makeSystem();
+        timeStepper = nullptr;
+        replay_s = 0;
+        return;
     }
 
-    pendulumSystem = new BallSystem(stepsize);
+    // explicit steppers are compiled per concrete system type
+    if (scene == "cloth") {
+        pendulumSystem = SpringSystem::makeCloth(30, 30, 0.15f, 400);
+        timeStepper = makeStaticStepper<SpringSystem>(integrator);
+    } else if (scene == "jelly") {
+        pendulumSystem = SpringSystem::makeJellyCube(8, 0.25f, 400);
+        timeStepper = makeStaticStepper<SpringSystem>(integrator);
+    } else {
+        pendulumSystem = scene_file ? new BallSystem(stepsize, *scene_file) : new BallSystem(stepsize);
+        timeStepper = makeStaticStepper<BallSystem>(integrator);
+    }
+
+    if (!timeStepper) {
+        switch (integrator) {
+        case 'i': timeStepper = new BackwardEuler(); break;
+        default: printf("Unrecognized integrator\n"); exit(-1);
+        }
+    }
+
+    keyframes->clear();
+    step_count = 0;
+
+    // only the first setup resumes, a reset starts over
+    if (resume) {
+        resume = false;
+        long step = loadCheckpoint(checkpoint_path, *pendulumSystem);
+        if (step >= 0) {
+            step_count = step;
+        }
+    }
+
+    shared_ids = nullptr;
+    if (!shm_name.empty()) {
+        int needed = (int)pendulumSystem->stateRef().size();
+        if (shared_state.capacity() < needed && !shared_state.open(shm_name, needed)) {
+            exit(-1);
+        }
+        BallSystem* balls = dynamic_cast<BallSystem*>(pendulumSystem);
+        shared_ids = balls ? &balls->_ids : nullptr;
+        shared_state.publish(pendulumSystem->stateView(), shared_ids, step_count, step_count * (double)stepsize);
+    }
+
+    if (!export_path.empty()) {
+        if (!dynamic_cast<BallSystem*>(pendulumSystem)) {
+            printf("Exporting needs the balls scene\n");
+            exit(-1);
+        }
+        if (!exporter.start(export_path)) {
+            exit(-1);
+        }
+    }
+
+    if (!record_path.empty()) {
+        BallSystem* balls = dynamic_cast<BallSystem*>(pendulumSystem);
+        record_interval = std::max(1, (int)lround(RECORD_FRAME_S / stepsize));
+        record_first_step = step_count;
+        if (!balls) {
+            printf("Recording needs the balls scene\n");
+            exit(-1);
+        }
+        if (!recorder.open(record_path, *balls, record_interval * stepsize)) {
+            exit(-1);
+        }
+    }
 }
 
 void freeSystem() {
@@ -188,9 +358,28 @@ void freeSystem() {
     delete pendulumSystem; pendulumSystem = nullptr;
 }
 
+// frame metrics for the telemetry socket, times in seconds
+void publishTelemetry(long steps, double simulate_s, double draw_s, double frame_s)
+{
+    TelemetryStats stats;
+    stats.step = step_count;
+    stats.simulated_s = step_count * (double)h;
+    stats.steps_per_s = frame_s > 0 ? steps / frame_s : 0;
+    stats.particles = pendulumSystem->stateRef().size() / 2;
+    stats.kinetic_energy = pendulumSystem->kineticEnergy();
+    stats.step_ms = steps > 0 ? 1000 * simulate_s / steps : 0;
+    stats.simulate_ms = 1000 * simulate_s;
+    stats.draw_ms = 1000 * draw_s;
+    stats.frame_ms = 1000 * frame_s;
+    stats.paused = paused;
+    stats.arena_bytes = pendulumSystem->stepArena().highWaterBytes();
+    telemetry.publish(stats);
+}
+
 void resetTime() {
     elapsed_s = 0;
     simulated_s = 0;
+    next_checkpoint_s = CHECKPOINT_S;
     start_tick = glfwGetTimerValue();
 }
 
@@ -198,11 +387,79 @@ void resetTime() {
 //       update the external forces before each time step
 void stepSystem()
 {
+    // replay: move the playback clock with the wall clock, looping at the end
+    if (replaying) {
+        if (!paused) {
+            replay_s += elapsed_s - simulated_s;
+            if (replay_s > replay.duration()) {
+                replay_s = 0;
+            }
+        }
+        simulated_s = elapsed_s;
+        std::vector<Vector3f> state;
+        replay.interpolate(replay_s, replay_cubic, state);
+        pendulumSystem->setState(state);
+        return;
+    }
+    // paused: keep the clock level so resuming doesn't try to catch up
+    if (paused) {
+        simulated_s = elapsed_s;
+        return;
+    }
     // step until simulated_s has caught up with elapsed_s.
     while (simulated_s < elapsed_s) {
-        timeStepper->takeStep(pendulumSystem, h);
+        advanceStep();
         simulated_s += h;
     }
+    // retried every frame while the previous checkpoint is still being written
+    if (checkpoints.isOpen() && elapsed_s >= next_checkpoint_s && checkpoints.submit(*pendulumSystem, step_count)) {
+        next_checkpoint_s = elapsed_s + CHECKPOINT_S;
+    }
+}
+
+// one step, keyframed on the interval unless a later keyframe exists already
+// (re-simulating after a seek reproduces the same states)
+void advanceStep()
+{
+    if (step_count % keyframes->interval() == 0 && step_count > keyframes->newestStep()) {
+        keyframes->record(step_count, *pendulumSystem);
+    }
+    // frames already written are not rewritten after a rewind, re-simulation reproduces them
+    long record_step = step_count - record_first_step;
+    if (!record_path.empty() && record_step % record_interval == 0 && record_step / record_interval == recorder.numFrames()) {
+        recorder.writeFrame(*static_cast<BallSystem*>(pendulumSystem));
+    }
+    if (exporter.isOpen() && step_count % export_stride == 0 && step_count > exporter.lastStep()) {
+        exporter.submit(*static_cast<BallSystem*>(pendulumSystem), step_count);
+    }
+    timeStepper->takeStep(pendulumSystem, h);
+    step_count++;
+    if (shared_state.isOpen()) {
+        shared_state.publish(pendulumSystem->stateView(), shared_ids, step_count, step_count * (double)h);
+    }
+}
+
+// restore the nearest keyframe at or before target and re-simulate up to it
+void seekStep(long target)
+{
+    if (target < 0) {
+        target = 0;
+    }
+    long from = keyframes->restore(target, *pendulumSystem);
+    if (from < 0) {
+        printf("Step %ld is no longer buffered, oldest keyframe is step %ld\n", target, keyframes->oldestStep());
+        return;
+    }
+    step_count = from;
+    while (step_count < target) {
+        advanceStep();
+    }
+    if (shared_state.isOpen() && from == target) {
+        shared_state.publish(pendulumSystem->stateView(), shared_ids, step_count, step_count * (double)h);
+    }
+    printf("Step %ld (keyframe %ld, %ld re-simulated, %d keyframes in %.1f of %.1f MB)\n",
+           step_count, from, target - from, keyframes->size(),
+           keyframes->bytesUsed() / 1048576.0, keyframes->rawBytes() / 1048576.0);
 }
 
 // Draw the current particle positions
@@ -232,11 +489,75 @@ void initRendering()
 // Set up OpenGL, define the callbacks and start the main loop
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        printf("Usage: %s <e|t|r> <timestep>\n", argv[0]);
+    // positional integrator, timestep, scene name and keyframe budget; flags anywhere
+    int keyframe_mb = KEYFRAME_MB;
+    const char* scene_path = nullptr;
+    const char* replay_path = nullptr;
+    std::vector<const char*> positional;
+    bool bad_args = false;
+    bool huge_pages = false;
+    bool first_touch = false;
+    for (int a=1; a<argc && !bad_args; a++) {
+        bool flag = !strcmp(argv[a], "--scene") || !strcmp(argv[a], "--record") || !strcmp(argv[a], "--replay") ||
+                    !strcmp(argv[a], "--shm") || !strcmp(argv[a], "--checkpoint") ||
+                    !strcmp(argv[a], "--export") || !strcmp(argv[a], "--export-stride") ||
+                    !strcmp(argv[a], "--telemetry");
+        if (flag && a + 1 >= argc) {
+            bad_args = true;
+        } else if (!strcmp(argv[a], "--scene")) {
+            scene_path = argv[++a];
+        } else if (!strcmp(argv[a], "--record")) {
+            record_path = argv[++a];
+        } else if (!strcmp(argv[a], "--replay")) {
+            replay_path = argv[++a];
+        } else if (!strcmp(argv[a], "--shm")) {
+            shm_name = argv[++a];
+        } else if (!strcmp(argv[a], "--checkpoint")) {
+            checkpoint_path = argv[++a];
+        } else if (!strcmp(argv[a], "--export")) {
+            export_path = argv[++a];
+        } else if (!strcmp(argv[a], "--export-stride")) {
+            export_stride = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--telemetry")) {
+            if (!telemetry.start(argv[++a])) {
+                return -1;
+            }
+        } else if (!strcmp(argv[a], "--resume")) {
+            resume = true;
+        } else if (!strcmp(argv[a], "--huge-pages")) {
+            huge_pages = true;
+        } else if (!strcmp(argv[a], "--first-touch")) {
+            first_touch = true;
+        } else {
+            positional.push_back(argv[a]);
+        }
+    }
+    // a replay needs no integrator or timestep
+    bad_args = bad_args || positional.size() > 4 || (positional.size() < 2 && !replay_path) ||
+               (resume && checkpoint_path.empty()) || export_stride < 1;
+
+    if (bad_args) {
+        printf("Usage: %s <e|t|r|m|d|i> <timestep> [balls|cloth|jelly] [keyframe_mb] [--scene file] [--record file] [--shm name]\n", argv[0]);
+        printf("       %*s [--checkpoint file [--resume]] [--export out.vtk|out.ply [--export-stride steps]]\n", (int)strlen(argv[0]), "");
+        printf("       %*s [--telemetry socket] [--huge-pages] [--first-touch]\n", (int)strlen(argv[0]), "");
+        printf("       %s --replay file\n", argv[0]);
         printf("       e: Integrator: Forward Euler\n");
         printf("       t: Integrator: Trapezoid\n");
         printf("       r: Integrator: RK 4\n");
+        printf("       m: Integrator: RK 4, float state accumulated in double\n");
+        printf("       d: Integrator: RK 4, double state (forces still evaluated in float)\n");
+        printf("       i: Integrator: Backward Euler (implicit)\n");
+        printf("       scene defaults to balls\n");
+        printf("       keyframe_mb caps the rewind buffer (default %d)\n", KEYFRAME_MB);
+        printf("       --scene builds the balls scene from a scene file (see scene.h)\n");
+        printf("       --record writes the balls' trajectory, --replay plays one back\n");
+        printf("       --shm publishes every step to POSIX shared memory name (e.g. /a3state)\n");
+        printf("       --checkpoint saves the system every %.0f s, --resume continues from the last save\n", CHECKPOINT_S);
+        printf("       --export writes out_<step>.vtk or .ply every %d steps (--export-stride) for ParaView\n", EXPORT_STRIDE);
+        printf("       --telemetry answers stats queries on a Unix socket (try: socat - UNIX-CONNECT:socket)\n");
+        printf("       --huge-pages backs large particle arrays with transparent huge pages,\n");
+        printf("       --first-touch spreads their pages over the NUMA nodes of the worker threads that stream them\n");
+        printf("       keys: P pause, ',' step back, '.' step forward, I cubic/linear replay, M memory use\n");
         printf("\n");
         printf("Try  : %s t 0.001\n", argv[0]);
         printf("       for trapezoid (1ms steps)\n");
@@ -245,9 +566,34 @@ int main(int argc, char** argv)
         return -1;
     }
 
-    integrator = argv[1][0];
-    h = (float)atof(argv[2]);
-    printf("Using Integrator %c with time step %.4f\n", integrator, h);
+    setLargeArrayPolicy(huge_pages, first_touch);
+
+    integrator = positional.size() > 0 ? positional[0][0] : 'r';
+    h = positional.size() > 1 ? (float)atof(positional[1]) : 0.01f;
+    if (positional.size() > 2) {
+        scene = positional[2];
+    }
+    if (positional.size() > 3) {
+        keyframe_mb = atoi(positional[3]);
+    }
+    if (scene_path) {
+        scene_file = new Scene();
+        if (!loadScene(scene_path, *scene_file)) {
+            return -1;
+        }
+    }
+    if (replay_path) {
+        replaying = true;
+        if (!replay.open(replay_path)) {
+            return -1;
+        }
+    } else {
+        printf("Using Integrator %c with time step %.4f\n", integrator, h);
+    }
+    keyframes = new KeyframeBuffer((size_t)keyframe_mb << 20, KEYFRAME_INTERVAL);
+    if (!checkpoint_path.empty() && !replaying) {
+        checkpoints.start(checkpoint_path);
+    }
 
 
     GLFWwindow* window = createOpenGLWindow(1024, 1024, "Assignment 3");
@@ -283,6 +629,7 @@ int main(int argc, char** argv)
     // Main Loop
     uint64_t freq = glfwGetTimerFrequency();
     resetTime();
+    uint64_t last_frame = glfwGetTimerValue();
     while (!glfwWindowShouldClose(window)) {
         // Clear the rendering window
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -295,10 +642,26 @@ int main(int argc, char** argv)
 
         uint64_t now = glfwGetTimerValue();
         elapsed_s = (double)(now - start_tick) / freq;
+        long steps_before = step_count;
         stepSystem();
+        uint64_t stepped = glfwGetTimerValue();
 
         // Draw the simulation
         drawSystem();
+#ifndef NDEBUG
+        // recorders reuse pooled storage, so this should only show while new primitives first appear
+        int recorder_allocations = VertexRecorder::takeAllocationCount();
+        if (recorder_allocations > 0) {
+            printf("step %ld: %d vertex recorder allocations this frame\n", step_count, recorder_allocations);
+        }
+#endif
+
+        if (telemetry.isOpen() && !replaying) {
+            uint64_t drawn = glfwGetTimerValue();
+            publishTelemetry(std::max(0L, step_count - steps_before), (double)(stepped - now) / freq,
+                             (double)(drawn - stepped) / freq, (double)(now - last_frame) / freq);
+        }
+        last_frame = now;
 
         // Make back buffer visible
         glfwSwapBuffers(window);
@@ -311,7 +674,9 @@ int main(int argc, char** argv)
     // glGen* or glCreate* must be freed.
     glDeleteProgram(program_color);
     glDeleteProgram(program_light);
-
+    checkpoints.stop();
+    exporter.stop();
+    telemetry.stop();
 
     return 0;	// This line is never reached.
 }
@@ -2,8 +2,10 @@
 
 #include "gl.h"
 #include "camera.h"
+#include "largearray.h"
 #include <random>
 #include <cstdio>
+#include <cmath>
 
 float rand_uniform(float low, float hi) {
    float abs = hi - low;
@@ -13,6 +15,144 @@ float rand_uniform(float low, float hi) {
    return f;
 }
 
+void ParticleSystem::jacobianProduct(const std::vector<Vector3f>& state, const std::vector<Vector3f>& f,
+                                     const std::vector<Vector3f>& dstate, std::vector<Vector3f>& out)
+{
+    float state_sq = 0;
+    float dir_sq = 0;
+    for (size_t i=0; i<state.size(); i++) {
+        state_sq += state[i].absSquared();
+        dir_sq += dstate[i].absSquared();
+    }
+    out.assign(state.size(), Vector3f(0, 0, 0));
+    if (dir_sq == 0) {
+        return;
+    }
+
+    // usual sqrt(machine epsilon) scaling of the difference step
+    float eps = 3.5e-4f * (1 + sqrtf(state_sq)) / sqrtf(dir_sq);
+    int mark = m_arena.mark();
+    std::vector<Vector3f>& shifted = m_arena.take(state.size());
+    for (size_t i=0; i<state.size(); i++) {
+        shifted[i] = state[i] + eps * dstate[i];
+    }
+    std::vector<Vector3f>& f_shifted = m_arena.take(state.size());
+    evalFInto(shifted, f_shifted);
+    for (size_t i=0; i<state.size(); i++) {
+        out[i] = (f_shifted[i] - f[i]) / eps;
+    }
+    m_arena.rewind(mark);
+}
+
+void ParticleSystem::evalFStage(float a, const std::vector<Vector3f>& kin, std::vector<Vector3f>& kout,
+                                std::vector<Vector3f>& sum, float w, bool accumulate)
+{
+    int mark = m_arena.mark();
+    std::vector<Vector3f>& stage = m_arena.take(m_vVecState.size());
+    parallelForLarge((int)stage.size(), sizeof(Vector3f), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            stage[i] = a == 0 ? m_vVecState[i] : m_vVecState[i] + a * kin[i];
+        }
+    });
+    evalFInto(stage, kout);
+    m_arena.rewind(mark);
+    sum.resize(kout.size());
+    parallelForLarge((int)kout.size(), sizeof(Vector3f), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            sum[i] = accumulate ? sum[i] + w * kout[i] : w * kout[i];
+        }
+    });
+}
+
+std::vector<Vector3f>& ParticleSystem::nextState()
+{
+    reserveLargeArray(m_vNextState, m_vVecState.size());
+    m_vNextState.resize(m_vVecState.size());
+    return m_vNextState;
+}
+
+void ParticleSystem::advanceState(const std::vector<Vector3f>& dir, float scale)
+{
+    parallelForLarge((int)m_vVecState.size(), sizeof(Vector3f), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            m_vVecState[i] += scale * dir[i];
+        }
+    });
+    m_precise_valid = false;
+}
+
+std::vector<Vec3<double>>& ParticleSystem::preciseState()
+{
+    if (!m_precise_valid) {
+        reserveLargeArray(m_vPreciseState, m_vVecState.size());
+        m_vPreciseState.resize(m_vVecState.size());
+        parallelForLarge((int)m_vVecState.size(), sizeof(Vec3<double>), [&](int begin, int end) {
+            for (int i=begin; i<end; i++) {
+                m_vPreciseState[i] = Vec3<double>(m_vVecState[i]);
+            }
+        });
+        m_precise_valid = true;
+    }
+    return m_vPreciseState;
+}
+
+std::vector<Vec3<double>>& ParticleSystem::nextPreciseState()
+{
+    reserveLargeArray(m_vNextPreciseState, m_vVecState.size());
+    m_vNextPreciseState.resize(m_vVecState.size());
+    return m_vNextPreciseState;
+}
+
+void ParticleSystem::swapPreciseState()
+{
+    m_vPreciseState.swap(m_vNextPreciseState);
+    m_vVecState.resize(m_vPreciseState.size());
+    parallelForLarge((int)m_vPreciseState.size(), sizeof(Vec3<double>), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            m_vVecState[i] = m_vPreciseState[i].toFloat();
+        }
+    });
+    m_precise_valid = true;
+}
+
+void ParticleSystem::advanceStateMixed(const std::vector<Vector3f>& dir, double scale)
+{
+    std::vector<Vec3<double>>& precise = preciseState();
+    parallelForLarge((int)m_vVecState.size(), sizeof(Vec3<double>), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            precise[i] += scale * Vec3<double>(dir[i]);
+            m_vVecState[i] = precise[i].toFloat();
+        }
+    });
+}
+
+double ParticleSystem::kineticEnergy() const
+{
+    double energy = 0;
+    for (size_t i=1; i<m_vVecState.size(); i+=2) {
+        energy += 0.5 * m_vVecState[i].absSquared();
+    }
+    return energy;
+}
+
+void ParticleSystem::saveSnapshot(std::vector<char>& out) const
+{
+    snapshotWrite(out, m_vVecState);
+    // the double state only while it matches, an empty one otherwise
+    if (m_precise_valid) {
+        snapshotWrite(out, m_vPreciseState);
+    } else {
+        snapshotWrite(out, std::vector<Vec3<double>>());
+    }
+}
+
+void ParticleSystem::loadSnapshot(const char*& in)
+{
+    snapshotRead(in, m_vVecState);
+    snapshotRead(in, m_vPreciseState);
+    m_precise_valid = !m_vPreciseState.empty() && m_vPreciseState.size() == m_vVecState.size();
+}
+
 GLProgram::GLProgram(uint32_t apl, uint32_t apc, Camera* ac)
     : program_light(apl), program_color(apc), camera(ac) 
 {
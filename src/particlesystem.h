@@ -4,6 +4,11 @@
 #include <vector>
 #include <vecmath.h>
 #include <cstdint>
+#include <cstring>
+
+#include "span.h"
+#include "steparena.h"
+#include "vec3.h"
 
 
 // helper for uniform distribution
@@ -16,18 +21,121 @@ public:
     virtual ~ParticleSystem() {}
 
     // for a given state, evaluate derivative f(X,t)
-    virtual std::vector<Vector3f> evalF(std::vector<Vector3f>& state) = 0;
+    virtual std::vector<Vector3f> evalF(const std::vector<Vector3f>& state) = 0;
+    // same into f, which systems fill in place, so steppers that take f from
+    // the step arena allocate nothing
+    virtual void evalFInto(const std::vector<Vector3f>& state, std::vector<Vector3f>& f) { f = evalF(state); }
+
+    // render the current state
+    virtual void draw(GLProgram&) = 0;
 
     // getter method for the system's state
     std::vector<Vector3f> getState() { return m_vVecState; };
+    // read-only reference to the state, without the copy getState makes
+    const std::vector<Vector3f>& stateRef() const { return m_vVecState; }
+    // the same as a view, for code that only needs the entries
+    Span<const Vector3f> stateView() const { return Span<const Vector3f>(m_vVecState); }
+
+    // per-step temporaries, reset by the stepper at the start of every step
+    StepArena& stepArena() { return m_arena; }
 
     // setter method for the system's state
-    void setState(const std::vector<Vector3f>  & newState) { m_vVecState = newState; };
+    void setState(const std::vector<Vector3f>  & newState) { m_vVecState = newState; m_precise_valid = false; };
+
+    // double-buffered update without copies: a stepper writes the new state
+    // into nextState() (sized like the state, contents unspecified) while still
+    // reading stateRef(), then swapState() makes it current. the old state
+    // becomes the next back buffer
+    std::vector<Vector3f>& nextState();
+    void swapState() { m_vVecState.swap(m_vNextState); m_precise_valid = false; }
+
+    // the state in double, for steppers that integrate wider than float. it
+    // is kept next to the float state (what evalF and drawing see) while
+    // valid; anything else that writes the float state invalidates it and the
+    // next call widens the float state again
+    std::vector<Vec3<double>>& preciseState();
+    // back buffer like nextState(); swapPreciseState() makes it current and
+    // rounds it into the float state
+    std::vector<Vec3<double>>& nextPreciseState();
+    void swapPreciseState();
+    void invalidatePreciseState() { m_precise_valid = false; }
+
+    // called by the time steppers before the first and after the last evalF of
+    // a step, so a system can share work (e.g. collision broadphase) across stages
+    virtual void beginStep(float stepSize) {}
+    virtual void endStep() {}
+
+    // directional derivative of evalF at state along dstate into out, where
+    // f = evalF(state). default is a forward difference (one extra evalF),
+    // override with analytic Jacobians where they are cheap (e.g. springs)
+    virtual void jacobianProduct(const std::vector<Vector3f>& state, const std::vector<Vector3f>& f,
+                                 const std::vector<Vector3f>& dstate, std::vector<Vector3f>& out);
+
+    // one fused Runge-Kutta stage: kout = evalF(state + a * kin) with the stage
+    // state formed on the fly, then sum = w * kout (accumulate false) or
+    // sum += w * kout. kin is not read when a == 0 and must not alias kout.
+    // the default materializes the stage state and calls evalF
+    virtual void evalFStage(float a, const std::vector<Vector3f>& kin, std::vector<Vector3f>& kout,
+                            std::vector<Vector3f>& sum, float w, bool accumulate);
+
+    // in-place state += scale * dir, the final combine of a fused step
+    void advanceState(const std::vector<Vector3f>& dir, float scale);
+    // same, but the state is accumulated in preciseState() and only rounded to
+    // float for evalF, so long runs keep the low bits of every increment
+    void advanceStateMixed(const std::vector<Vector3f>& dir, double scale);
+
+    // total kinetic energy, unit particle mass unless a system knows better
+    virtual double kineticEnergy() const;
+
+    // everything the evolution depends on, as bytes, for keyframes: loading a
+    // snapshot and stepping must reproduce the original run bit for bit.
+    // overrides append their own per-particle state after the base class'
+    virtual void saveSnapshot(std::vector<char>& out) const;
+    // reads what saveSnapshot wrote, advancing in past it
+    virtual void loadSnapshot(const char*& in);
 
  protected:
     std::vector<Vector3f> m_vVecState;
+    std::vector<Vector3f> m_vNextState;  // back buffer of nextState/swapState
+    std::vector<Vec3<double>> m_vPreciseState;  // double and mixed precision steppers only
+    std::vector<Vec3<double>> m_vNextPreciseState;
+    bool m_precise_valid = false;  // m_vPreciseState rounds to m_vVecState
+    StepArena m_arena;
 };
 
+// raw copies of plain-data vectors and values for the snapshot byte streams
+template <class T>
+void snapshotWrite(std::vector<char>& out, const std::vector<T>& v)
+{
+    uint64_t n = v.size();
+    out.insert(out.end(), (const char*)&n, (const char*)&n + sizeof(n));
+    out.insert(out.end(), (const char*)v.data(), (const char*)v.data() + n * sizeof(T));
+}
+
+template <class T>
+void snapshotRead(const char*& in, std::vector<T>& v)
+{
+    uint64_t n;
+    memcpy(&n, in, sizeof(n));
+    in += sizeof(n);
+    v.resize(n);
+    memcpy((void*)v.data(), in, n * sizeof(T));
+    in += n * sizeof(T);
+}
+
+template <class T>
+void snapshotWriteValue(std::vector<char>& out, const T& value)
+{
+    out.insert(out.end(), (const char*)&value, (const char*)&value + sizeof(T));
+}
+
+template <class T>
+void snapshotReadValue(const char*& in, T& value)
+{
+    memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+}
+
 /* GLProgram is a helper for updating uniform variables.
    Before drawing geometry, update the model matrix and diffuse color.
 
@@ -0,0 +1,369 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "threadpool.h"
+
+// the original hard-coded scene
+const float DEFAULT_MASS = 1;
+const float DEFAULT_DRAG = 1;
+const float DEFAULT_RADIUS = 0.75f;
+const int DEFAULT_REORDER_INTERVAL = 100;
+
+// PlaneTable hit masks are 32 bits wide
+const int MAX_WALLS = 32;
+
+// state indices 2 * i + 1 must still fit an int
+const int MAX_SCENE_BALLS = INT_MAX / 2;
+
+Scene::Scene() :
+    mass(DEFAULT_MASS),
+    drag(DEFAULT_DRAG),
+    broadphase(BROADPHASE_GRID),
+    collision_mode(COLLIDE_PAIRS),
+    reorder_interval(DEFAULT_REORDER_INTERVAL),
+    compact_storage(false)
+{
+}
+
+Scene defaultScene(int num_particles)
+{
+    Scene scene;
+    scene.walls.emplace_back(Vector3f(-1, -3, -1), Vector3f(-1, -3, 1), Vector3f(1, -3, 1));  // floor
+    scene.walls.emplace_back(Vector3f(1, 1, 3.f), Vector3f(1, -3, 3.f), Vector3f(-1, 1, 5.f));  // front
+    scene.walls.emplace_back(Vector3f(-1, 3, 0.75f), Vector3f(-1, -3, 0.75f), Vector3f(1, 3, 0.f));  // back
+    scene.walls.emplace_back(Vector3f(-3, 1, 1), Vector3f(-3, -3, 1), Vector3f(-3, 1, -1));  // left
+    scene.walls.emplace_back(Vector3f(3, 1, -1), Vector3f(3, -1, -1), Vector3f(3, 1, 1));  // right
+
+    // big vector of 2n with position at even indices, velocity at odd
+    for (int i=0; i<num_particles; i++) {
+        Vector3f position = Vector3f((i%3)-1, (i+1) * 1, 4);
+        scene.state.push_back(position);  // position
+        scene.state.emplace_back(rand_uniform(0, 1), rand_uniform(0, 1), rand_uniform(0, 1));  // velocity
+        scene.radii.push_back(DEFAULT_RADIUS);
+    }
+    for (int i=0; i<num_particles; i++) {
+        scene.colors.emplace_back(rand_uniform(0, 1), rand_uniform(0, 1), rand_uniform(0, 1));
+    }
+    return scene;
+}
+
+
+namespace
+{
+
+enum GeneratorKind { GENERATE_BOX, GENERATE_LATTICE };
+
+// a box or lattice directive, expanded after the whole file is read
+struct Generator {
+    GeneratorKind kind;
+    int start;  // first particle index
+    int count;
+    int nx, ny, nz;  // lattice dimensions
+    Vector3f lo;
+    Vector3f hi;
+    float speed;
+    float spacing;
+    uint64_t seed;
+};
+
+// splitmix64 finalizer: random numbers keyed by (seed, particle, component), so
+// generated scenes come out the same on any number of threads
+uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+float hashUniform(uint64_t seed, uint64_t index, int component, float lo, float hi)
+{
+    uint64_t bits = mix(seed ^ mix(index * 8 + component));
+    return lo + (hi - lo) * (float)((bits >> 40) * (1.0 / (1ull << 24)));
+}
+
+bool isBlank(const char* p, const char* end)
+{
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    return p == end || *p == '#';
+}
+
+// count numbers starting at p, all before end; p is left after the last one
+bool parseFloats(const char*& p, const char* end, float* out, int count)
+{
+    for (int k=0; k<count; k++) {
+        char* next;
+        out[k] = strtof(p, &next);
+        if (next == p || next > end) {
+            return false;
+        }
+        p = next;
+    }
+    return true;
+}
+
+bool parseInts(const char*& p, const char* end, int* out, int count)
+{
+    for (int k=0; k<count; k++) {
+        char* next;
+        long value = strtol(p, &next, 10);
+        if (next == p || next > end || value < INT_MIN || value > INT_MAX) {
+            return false;
+        }
+        out[k] = (int)value;
+        p = next;
+    }
+    return true;
+}
+
+// one "particle px py pz vx vy vz" line, p just after the keyword
+bool parseParticle(const char* p, const char* end, Vector3f& position, Vector3f& velocity)
+{
+    float v[6];
+    if (!parseFloats(p, end, v, 6) || !isBlank(p, end)) {
+        return false;
+    }
+    position = Vector3f(v[0], v[1], v[2]);
+    velocity = Vector3f(v[3], v[4], v[5]);
+    return true;
+}
+
+void expand(const Generator& g, Scene& scene)
+{
+    ThreadPool::shared().parallelFor(g.count, [&](int worker, int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            Vector3f position;
+            Vector3f velocity(0, 0, 0);
+            if (g.kind == GENERATE_BOX) {
+                position = Vector3f(hashUniform(g.seed, g.start + i, 0, g.lo[0], g.hi[0]),
+                                    hashUniform(g.seed, g.start + i, 1, g.lo[1], g.hi[1]),
+                                    hashUniform(g.seed, g.start + i, 2, g.lo[2], g.hi[2]));
+                velocity = Vector3f(hashUniform(g.seed, g.start + i, 3, -g.speed, g.speed),
+                                    hashUniform(g.seed, g.start + i, 4, -g.speed, g.speed),
+                                    hashUniform(g.seed, g.start + i, 5, -g.speed, g.speed));
+            } else {
+                int x = i % g.nx;
+                int y = (i / g.nx) % g.ny;
+                int z = i / (g.nx * g.ny);
+                position = g.lo + g.spacing * Vector3f(x, y, z);
+            }
+            scene.state[2 * (g.start + i)] = position;
+            scene.state[2 * (g.start + i) + 1] = velocity;
+        }
+    });
+}
+}
+
+bool loadScene(const std::string& path, Scene& scene)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        printf("Cannot open scene %s\n", path.c_str());
+        return false;
+    }
+    std::string text;
+    char chunk[1 << 16];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        text.append(chunk, got);
+    }
+    fclose(f);
+
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+    // line starts, the only serial pass over the whole text besides the keywords
+    std::vector<size_t> lines;
+    for (size_t pos=0; pos < text.size(); ) {
+        lines.push_back(pos);
+        const char* nl = (const char*)memchr(text.data() + pos, '\n', text.size() - pos);
+        pos = nl ? nl - text.data() + 1 : text.size();
+    }
+    lines.push_back(text.size());
+
+    scene = Scene();
+    float radius = DEFAULT_RADIUS;
+    uint64_t seed = 1;
+    std::vector<std::pair<int, int>> particle_lines;  // (line, particle index)
+    std::vector<Generator> generators;
+    // (first particle, seed) wherever the seed in effect changes, for the colors
+    std::vector<std::pair<int, uint64_t>> color_seeds;
+    int count = 0;
+    auto noteSeed = [&]() {
+        if (color_seeds.empty() || color_seeds.back().second != seed) {
+            color_seeds.emplace_back(count, seed);
+        }
+    };
+
+    for (int l=0; l+1<(int)lines.size(); l++) {
+        const char* p = text.data() + lines[l];
+        const char* end = text.data() + lines[l + 1];
+        while (p < end && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (p == end || *p == '#') {
+            continue;
+        }
+        const char* tag_end = p;
+        while (tag_end < end && !isspace((unsigned char)*tag_end)) {
+            tag_end++;
+        }
+        std::string tag(p, tag_end);
+        p = tag_end;
+
+        // particle lines only get a slot here, their numbers are parsed in parallel below
+        bool ok = true;
+        if (tag == "particle" && count < MAX_SCENE_BALLS) {
+            noteSeed();
+            particle_lines.emplace_back(l, count);
+            scene.radii.push_back(radius);
+            count++;
+            continue;
+        } else if (tag == "particle") {
+            ok = false;
+        } else if ((tag == "mass" || tag == "drag") && count > 0) {
+            // one value for the whole system, it can't change between particles
+            printf("%s:%d: %s must come before the first particle\n", path.c_str(), l + 1, tag.c_str());
+            return false;
+        } else if (tag == "mass") {
+            ok = parseFloats(p, end, &scene.mass, 1) && scene.mass > 0;
+        } else if (tag == "drag") {
+            ok = parseFloats(p, end, &scene.drag, 1);
+        } else if (tag == "radius") {
+            ok = parseFloats(p, end, &radius, 1) && radius > 0;
+        } else if (tag == "seed") {
+            int s;
+            ok = parseInts(p, end, &s, 1);
+            seed = (uint64_t)s;
+        } else if (tag == "reorder") {
+            ok = parseInts(p, end, &scene.reorder_interval, 1);
+        } else if (tag == "broadphase" || tag == "collision" || tag == "collider" || tag == "storage") {
+            while (p < end && isspace((unsigned char)*p)) {
+                p++;
+            }
+            const char* arg_end = end;
+            while (arg_end > p && isspace((unsigned char)arg_end[-1])) {
+                arg_end--;
+            }
+            std::string arg(p, arg_end);
+            p = end;
+            if (tag == "broadphase") {
+                ok = arg == "grid" || arg == "hgrid" || arg == "all";
+                scene.broadphase = arg == "hgrid" ? BROADPHASE_HIERARCHICAL_GRID :
+                                   arg == "all" ? BROADPHASE_ALL_PAIRS : BROADPHASE_GRID;
+            } else if (tag == "collision") {
+                ok = arg == "pairs" || arg == "parallel" || arg == "perball";
+                scene.collision_mode = arg == "parallel" ? COLLIDE_PAIRS_PARALLEL :
+                                       arg == "perball" ? COLLIDE_PER_BALL : COLLIDE_PAIRS;
+            } else if (tag == "storage") {
+                ok = arg == "full" || arg == "compact";
+                scene.compact_storage = arg == "compact";
+            } else {
+                MeshCollider mesh;
+                if (!mesh.load(arg[0] == '/' ? arg : dir + arg)) {
+                    return false;
+                }
+                scene.colliders.push_back(mesh);
+            }
+        } else if (tag == "wall") {
+            float v[9];
+            ok = parseFloats(p, end, v, 9) && (int)scene.walls.size() < MAX_WALLS;
+            if (ok) {
+                scene.walls.emplace_back(Vector3f(v[0], v[1], v[2]), Vector3f(v[3], v[4], v[5]), Vector3f(v[6], v[7], v[8]));
+            }
+        } else if (tag == "box" || tag == "lattice") {
+            Generator g;
+            g.start = count;
+            g.seed = mix(seed + generators.size());
+            float v[7];
+            if (tag == "box") {
+                g.kind = GENERATE_BOX;
+                ok = parseInts(p, end, &g.count, 1) && parseFloats(p, end, v, 7) && g.count >= 0;
+                g.lo = Vector3f(v[0], v[1], v[2]);
+                g.hi = Vector3f(v[3], v[4], v[5]);
+                g.speed = v[6];
+            } else {
+                g.kind = GENERATE_LATTICE;
+                int n[3];
+                ok = parseInts(p, end, n, 3) && parseFloats(p, end, v, 4) && n[0] > 0 && n[1] > 0 && n[2] > 0;
+                int64_t total = ok ? (int64_t)n[0] * n[1] * n[2] : 0;
+                ok = ok && total <= MAX_SCENE_BALLS;
+                g.nx = n[0];
+                g.ny = n[1];
+                g.nz = n[2];
+                g.count = ok ? (int)total : 0;
+                g.lo = Vector3f(v[0], v[1], v[2]);
+                g.spacing = v[3];
+            }
+            // total over every line, checked before it can overflow
+            ok = ok && g.count <= MAX_SCENE_BALLS - count;
+            if (ok) {
+                noteSeed();
+                generators.push_back(g);
+                scene.radii.insert(scene.radii.end(), g.count, radius);
+                count += g.count;
+            }
+        } else {
+            printf("%s:%d: unknown directive %s\n", path.c_str(), l + 1, tag.c_str());
+            return false;
+        }
+        if (!ok || !isBlank(p, end)) {
+            printf("%s:%d: bad %s line\n", path.c_str(), l + 1, tag.c_str());
+            return false;
+        }
+    }
+
+    // fill every particle in parallel: explicit lines, generators, colors
+    scene.state.resize(2 * (size_t)count);
+    scene.colors.resize(count);
+    ThreadPool& pool = ThreadPool::shared();
+    std::vector<int> bad_line(pool.size(), -1);
+    pool.parallelFor((int)particle_lines.size(), [&](int worker, int begin, int end) {
+        for (int k=begin; k<end; k++) {
+            int l = particle_lines[k].first;
+            int i = particle_lines[k].second;
+            const char* p = text.data() + lines[l];
+            p = strstr(p, "particle") + strlen("particle");
+            if (!parseParticle(p, text.data() + lines[l + 1], scene.state[2*i], scene.state[2*i+1]) && bad_line[worker] < 0) {
+                bad_line[worker] = l;
+            }
+        }
+    });
+    for (int l : bad_line) {
+        if (l >= 0) {
+            printf("%s:%d: bad particle line\n", path.c_str(), l + 1);
+            return false;
+        }
+    }
+    for (const Generator& g : generators) {
+        expand(g, scene);
+    }
+    pool.parallelFor(count, [&](int worker, int begin, int end) {
+        // last seed run starting at or before begin, then follow the runs along
+        size_t run = std::upper_bound(color_seeds.begin(), color_seeds.end(), std::make_pair(begin, UINT64_MAX)) -
+                     color_seeds.begin() - 1;
+        for (int i=begin; i<end; i++) {
+            while (run + 1 < color_seeds.size() && color_seeds[run + 1].first <= i) {
+                run++;
+            }
+            uint64_t s = color_seeds[run].second;
+            scene.colors[i] = Vector3f(hashUniform(s, i, 6, 0, 1), hashUniform(s, i, 7, 0, 1), hashUniform(s, i, 8, 0, 1));
+        }
+    });
+
+    if (scene.walls.empty()) {
+        printf("Warning: scene %s has no walls\n", path.c_str());
+    }
+    printf("Loaded scene %s: %d balls, %d walls, %d colliders\n", path.c_str(), count,
+           (int)scene.walls.size(), (int)scene.colliders.size());
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef A3_SCENE_H
+#define A3_SCENE_H
+
+#include <string>
+#include <vector>
+#include <vecmath.h>
+
+#include "ballsystem.h"
+#include "trianglemesh.h"
+#include "wall.h"
+
+/**
+ * Everything a BallSystem is built from: physical constants, broadphase
+ * settings, walls, mesh colliders and the particles themselves. Either the
+ * built-in default (defaultScene) or read from a text file (loadScene):
+ *
+ *   # comment
+ *   mass 1                      physical constants shared by every ball, so
+ *   drag 1                      only allowed before the first particle
+ *   radius 0.75                 applies to the particles that follow
+ *   seed 7                      for the random generators and colors that follow
+ *   broadphase grid|hgrid|all
+ *   collision pairs|parallel|perball
+ *   reorder 100                 steps between Morton reorders, 0 disables
+ *   storage full|compact        compact: RGBA8 colors instead of float
+ *   wall x y z  x y z  x y z    three corners, as Wall(); the first wall is the floor
+ *   collider mesh.obj           static OBJ/PLY mesh, relative to the scene file
+ *   particle px py pz  vx vy vz
+ *   box n  x0 y0 z0  x1 y1 z1  speed    n balls uniform in the box, velocity in [-speed, speed]
+ *   lattice nx ny nz  x0 y0 z0  spacing  resting balls on a regular grid
+ */
+struct Scene {
+    Scene();
+
+    float mass;
+    float drag;
+    Broadphase broadphase;
+    CollisionMode collision_mode;
+    int reorder_interval;
+    bool compact_storage;
+
+    std::vector<Wall> walls;
+    std::vector<MeshCollider> colliders;
+
+    // per particle: position at even and velocity at odd indices, like the system state
+    std::vector<Vector3f> state;
+    std::vector<float> radii;
+    std::vector<Vector3f> colors;
+
+    int numParticles() const { return (int)radii.size(); }
+};
+
+// the original hard-coded box of five walls with a column of num_particles
+// balls, drawn from rand() in the same order as before
+Scene defaultScene(int num_particles);
+
+// parse a scene file, particle lines and generators are filled on the shared
+// thread pool; false (with a message) on any error
+bool loadScene(const std::string& path, Scene& scene);
+
+
+#endif //A3_SCENE_H
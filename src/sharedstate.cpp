@@ -0,0 +1,202 @@
+#include "sharedstate.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// readers in other processes rely on the counter working without a lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "seqlock counter must be lock free");
+static_assert(sizeof(Vector3f) == 3 * sizeof(float), "state entries are copied as packed floats");
+
+const char SHARED_STATE_MAGIC[8] = {'A', '3', 'S', 'T', 'A', 'T', 'E', 0};
+const uint32_t SHARED_STATE_VERSION = 1;
+
+static size_t segmentSize(size_t capacity)
+{
+    return sizeof(SharedStateHeader) + capacity * 3 * sizeof(float) + capacity / 2 * sizeof(int32_t);
+}
+
+SharedStateWriter::SharedStateWriter() : _header(nullptr), _size(0)
+{
+}
+
+SharedStateWriter::~SharedStateWriter()
+{
+    close();
+}
+
+bool SharedStateWriter::open(const std::string& name, int capacity)
+{
+    close();
+#ifdef _WIN32
+    printf("Shared memory export is not supported on this platform\n");
+    return false;
+#else
+    // a segment left behind by a crashed run is replaced
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        printf("Cannot create shared memory %s\n", name.c_str());
+        return false;
+    }
+    size_t size = segmentSize(capacity);
+    if (ftruncate(fd, size) != 0) {
+        printf("Cannot size shared memory %s\n", name.c_str());
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        printf("Cannot map shared memory %s\n", name.c_str());
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // fresh pages are zero: sequence 0, nothing published yet
+    _header = new (mapped) SharedStateHeader();
+    memcpy(_header->magic, SHARED_STATE_MAGIC, sizeof(_header->magic));
+    _header->version = SHARED_STATE_VERSION;
+    _header->capacity = capacity;
+    _header->sequence.store(0, std::memory_order_release);
+    _name = name;
+    _size = size;
+    printf("Exporting state to shared memory %s (%.1f MB)\n", name.c_str(), size / 1048576.0);
+    return true;
+#endif
+}
+
+void SharedStateWriter::close()
+{
+#ifndef _WIN32
+    if (_header) {
+        munmap(_header, _size);
+        shm_unlink(_name.c_str());
+    }
+#endif
+    _header = nullptr;
+    _size = 0;
+}
+
+void SharedStateWriter::publish(Span<const Vector3f> state, const std::vector<int>* ids, uint64_t step, double simulated_s)
+{
+    if (!_header || state.size() > _header->capacity) {
+        return;
+    }
+    float* data = (float*)(_header + 1);
+    int32_t* id_data = (int32_t*)(data + 3 * (size_t)_header->capacity);
+
+    // seqlock: odd while writing, readers retry on odd or changed counters
+    uint64_t seq = _header->sequence.load(std::memory_order_relaxed);
+    _header->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(data, state.data(), state.size() * sizeof(Vector3f));
+    if (ids) {
+        memcpy(id_data, ids->data(), ids->size() * sizeof(int32_t));
+    }
+    _header->num_entries = (uint32_t)state.size();
+    _header->has_ids = ids != nullptr;
+    _header->step = step;
+    _header->simulated_s = simulated_s;
+
+    _header->sequence.store(seq + 2, std::memory_order_release);
+}
+
+
+SharedStateReader::SharedStateReader() : _header(nullptr), _size(0)
+{
+}
+
+SharedStateReader::~SharedStateReader()
+{
+    close();
+}
+
+bool SharedStateReader::open(const std::string& name)
+{
+    close();
+#ifdef _WIN32
+    printf("Shared memory export is not supported on this platform\n");
+    return false;
+#else
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        printf("No shared memory segment %s\n", name.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedStateHeader)) {
+        printf("Shared memory %s is not a state export\n", name.c_str());
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        printf("Cannot map shared memory %s\n", name.c_str());
+        return false;
+    }
+    _header = (const SharedStateHeader*)mapped;
+    _size = st.st_size;
+    if (memcmp(_header->magic, SHARED_STATE_MAGIC, sizeof(_header->magic)) != 0 ||
+        _header->version != SHARED_STATE_VERSION || segmentSize(_header->capacity) > _size) {
+        printf("Shared memory %s is not a state export\n", name.c_str());
+        close();
+        return false;
+    }
+    return true;
+#endif
+}
+
+void SharedStateReader::close()
+{
+#ifndef _WIN32
+    if (_header) {
+        munmap((void*)_header, _size);
+    }
+#endif
+    _header = nullptr;
+    _size = 0;
+}
+
+bool SharedStateReader::read(std::vector<Vector3f>& state, std::vector<int>& ids, uint64_t& step, double& simulated_s) const
+{
+    if (!_header) {
+        return false;
+    }
+    const float* data = (const float*)(_header + 1);
+    const int32_t* id_data = (const int32_t*)(data + 3 * (size_t)_header->capacity);
+    while (true) {
+        uint64_t before = _header->sequence.load(std::memory_order_acquire);
+        if (before == 0) {
+            return false;
+        }
+        if (before & 1) {
+            continue;  // publish in progress
+        }
+        uint32_t n = std::min(_header->num_entries, _header->capacity);
+        state.resize(n);
+        memcpy((void*)state.data(), data, n * sizeof(Vector3f));
+        ids.clear();
+        if (_header->has_ids) {
+            ids.assign(id_data, id_data + n / 2);
+        }
+        step = _header->step;
+        simulated_s = _header->simulated_s;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_header->sequence.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+}
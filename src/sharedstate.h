@@ -0,0 +1,69 @@
+#ifndef A3_SHAREDSTATE_H
+#define A3_SHAREDSTATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vecmath.h>
+
+#include "span.h"
+
+/**
+ * Live state export through a POSIX shared memory segment. The simulation
+ * publishes every completed step; readers in other processes map the segment
+ * and copy out consistent snapshots under a seqlock, so the writer never waits
+ * on them. Layout: this header, then capacity entries of float x, y, z (the
+ * state, position at even and velocity at odd entries), then capacity / 2
+ * int32 particle ids when has_ids is set.
+ */
+struct SharedStateHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;  // state entries the segment has room for
+    std::atomic<uint64_t> sequence;  // odd while a publish is in progress
+    uint64_t step;
+    double simulated_s;
+    uint32_t num_entries;
+    uint32_t has_ids;
+};
+
+class SharedStateWriter {
+public:
+    SharedStateWriter();
+    ~SharedStateWriter();  // unlinks the segment
+
+    // create (or replace) segment name with room for capacity state entries
+    bool open(const std::string& name, int capacity);
+    void close();
+    bool isOpen() const { return _header != nullptr; }
+    int capacity() const { return _header ? (int)_header->capacity : 0; }
+
+    // ids (one per particle, may be null) travel with the state for systems that reorder
+    void publish(Span<const Vector3f> state, const std::vector<int>* ids, uint64_t step, double simulated_s);
+
+private:
+    std::string _name;
+    SharedStateHeader* _header;
+    size_t _size;
+};
+
+class SharedStateReader {
+public:
+    SharedStateReader();
+    ~SharedStateReader();
+
+    // map an existing segment read-only, false if it does not exist or is not ours
+    bool open(const std::string& name);
+    void close();
+
+    // copy out one consistent snapshot, false if none was published yet
+    bool read(std::vector<Vector3f>& state, std::vector<int>& ids, uint64_t& step, double& simulated_s) const;
+
+private:
+    const SharedStateHeader* _header;
+    size_t _size;
+};
+
+
+#endif //A3_SHAREDSTATE_H
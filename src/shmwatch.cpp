@@ -0,0 +1,55 @@
+// Example consumer of the a3 --shm state export: maps the segment read-only and
+// prints a summary of the latest consistent snapshot at a fixed interval,
+// without ever blocking the simulation.
+//
+// usage: a3_shmwatch <name> [interval_ms] [count]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "sharedstate.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("usage: a3_shmwatch <name> [interval_ms] [count]\n");
+        return -1;
+    }
+    int interval_ms = argc > 2 ? atoi(argv[2]) : 1000;
+    int count = argc > 3 ? atoi(argv[3]) : -1;
+
+    SharedStateReader reader;
+    if (!reader.open(argv[1])) {
+        return -1;
+    }
+
+    std::vector<Vector3f> state;
+    std::vector<int> ids;
+    uint64_t step;
+    double simulated_s;
+    for (int k=0; count < 0 || k < count; k++) {
+        if (reader.read(state, ids, step, simulated_s)) {
+            int n = (int)state.size() / 2;
+            Vector3f center(0, 0, 0);
+            float max_speed = 0;
+            for (int i=0; i<n; i++) {
+                center += state[2*i];
+                max_speed = fmaxf(max_speed, state[2*i+1].abs());
+            }
+            if (n > 0) {
+                center = center / (float)n;
+            }
+            printf("step %llu  t %.3f s  %d particles  center (%.3f, %.3f, %.3f)  max speed %.3f\n",
+                   (unsigned long long)step, simulated_s, n, center[0], center[1], center[2], max_speed);
+        } else {
+            printf("nothing published yet\n");
+        }
+        fflush(stdout);
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef A3_SPAN_H
+#define A3_SPAN_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Non-owning view of a contiguous array, a stand-in for C++20 std::span. It
+ * stays valid until the storage it was taken from is resized, swapped or freed,
+ * so take it where it is used rather than keeping it across steps.
+ */
+template <typename T>
+class Span {
+public:
+    Span() : _data(nullptr), _size(0) {}
+    Span(T* data, size_t size) : _data(data), _size(size) {}
+    // any vector whose elements convert, so a std::vector<Vector3f> passes as Span<const Vector3f>
+    template <typename U, typename A>
+    Span(std::vector<U, A>& v) : _data(v.data()), _size(v.size()) {}
+    template <typename U, typename A>
+    Span(const std::vector<U, A>& v) : _data(v.data()), _size(v.size()) {}
+
+    T* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    T& operator[](size_t i) const { return _data[i]; }
+    T* begin() const { return _data; }
+    T* end() const { return _data + _size; }
+
+    Span subspan(size_t offset, size_t count) const { return Span(_data + offset, count); }
+
+private:
+    T* _data;
+    size_t _size;
+};
+
+
+#endif //A3_SPAN_H
@@ -0,0 +1,119 @@
+#include "spatialgrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+// spread the low 21 bits of v out to every third bit
+static uint64_t splitBits(uint32_t v) {
+    uint64_t x = v & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+    return splitBits(x) | (splitBits(y) << 1) | (splitBits(z) << 2);
+}
+
+SpatialGrid::SpatialGrid() {
+    _cell_size = 1;
+    _mask = 0;
+}
+
+uint32_t SpatialGrid::bucketOf(int cx, int cy, int cz) const {
+    // large primes from Teschner et al. "Optimized Spatial Hashing for Collision Detection"
+    uint32_t h = ((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u) ^ ((uint32_t)cz * 83492791u);
+    return h & _mask;
+}
+
+void SpatialGrid::build(const SphereSet& spheres, float cell_size) {
+    build(spheres, nullptr, spheres.count, cell_size);
+}
+
+void SpatialGrid::build(const SphereSet& spheres, const int* members, int count, float cell_size) {
+    _cell_size = cell_size;
+
+    // power of two table with about two buckets per particle
+    uint32_t buckets = 1;
+    while (buckets < 2 * (uint32_t)count) {
+        buckets <<= 1;
+    }
+    _mask = buckets - 1;
+
+    _bucket_start.assign(buckets + 1, 0);
+    _particle_bucket.resize(count);
+    _entries.resize(count);
+
+    // counting sort: count, prefix sum, scatter (keeps index order within a bucket).
+    // the scatter advances every bucket start to the next bucket's, shifting the
+    // table back by one restores it, so no second array is needed
+    for (int k=0; k<count; k++) {
+        int i = members ? members[k] : k;
+        uint32_t b = bucketOf((int)floorf(spheres.x[i] / cell_size), (int)floorf(spheres.y[i] / cell_size),
+                              (int)floorf(spheres.z[i] / cell_size));
+        _particle_bucket[k] = b;
+        _bucket_start[b + 1] += 1;
+    }
+    for (uint32_t b=0; b<buckets; b++) {
+        _bucket_start[b + 1] += _bucket_start[b];
+    }
+    for (int k=0; k<count; k++) {
+        _entries[_bucket_start[_particle_bucket[k]]++] = members ? members[k] : k;
+    }
+    for (uint32_t b=buckets; b>0; b--) {
+        _bucket_start[b] = _bucket_start[b - 1];
+    }
+    _bucket_start[0] = 0;
+}
+
+int SpatialGrid::occupiedBuckets() const {
+    int occupied = 0;
+    for (size_t b=0; b + 1<_bucket_start.size(); b++) {
+        occupied += _bucket_start[b + 1] > _bucket_start[b];
+    }
+    return occupied;
+}
+
+int SpatialGrid::maxBucketLoad() const {
+    uint32_t load = 0;
+    for (size_t b=0; b + 1<_bucket_start.size(); b++) {
+        load = std::max(load, _bucket_start[b + 1] - _bucket_start[b]);
+    }
+    return (int)load;
+}
+
+size_t SpatialGrid::memoryBytes() const {
+    return _bucket_start.capacity() * sizeof(uint32_t) + _entries.capacity() * sizeof(int) +
+           _particle_bucket.capacity() * sizeof(uint32_t);
+}
+
+void SpatialGrid::query(const Vector3f& point, std::vector<int>& out) const {
+    if (_entries.empty()) {
+        return;
+    }
+    int cx = (int)floorf(point[0] / _cell_size);
+    int cy = (int)floorf(point[1] / _cell_size);
+    int cz = (int)floorf(point[2] / _cell_size);
+
+    // neighboring cells can hash to the same bucket, only scan each bucket once
+    uint32_t buckets[27];
+    int n = 0;
+    for (int dx=-1; dx<=1; dx++) {
+        for (int dy=-1; dy<=1; dy++) {
+            for (int dz=-1; dz<=1; dz++) {
+                buckets[n++] = bucketOf(cx + dx, cy + dy, cz + dz);
+            }
+        }
+    }
+    std::sort(buckets, buckets + n);
+    n = (int)(std::unique(buckets, buckets + n) - buckets);
+
+    for (int k=0; k<n; k++) {
+        for (uint32_t e=_bucket_start[buckets[k]]; e<_bucket_start[buckets[k] + 1]; e++) {
+            out.push_back(_entries[e]);
+        }
+    }
+}
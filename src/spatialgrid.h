@@ -0,0 +1,50 @@
+#ifndef A3_SPATIALGRID_H
+#define A3_SPATIALGRID_H
+
+#include <cstdint>
+#include <vector>
+
+#include "sphere.h"
+
+// interleaves the low 21 bits of each cell coordinate into one z-order key
+uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z);
+
+/**
+ * Uniform hash grid over sphere centers, rebuilt from scratch each evalF.
+ * Particles are binned with a counting sort so every bucket is one contiguous
+ * run of indices; spatially sorted particles make those runs cache friendly.
+ */
+class SpatialGrid {
+public:
+    SpatialGrid();
+
+    // bin every sphere center into cells of the given edge length
+    void build(const SphereSet& spheres, float cell_size);
+    // bin only spheres members[0..count), queries still return sphere indices
+    void build(const SphereSet& spheres, const int* members, int count, float cell_size);
+
+    // append the indices of all particles in the 27 cells around point
+    void query(const Vector3f& point, std::vector<int>& out) const;
+
+    float cellSize() const { return _cell_size; }
+    int size() const { return (int)_entries.size(); }
+
+    // occupancy: buckets holding at least one particle, and the fullest bucket
+    int occupiedBuckets() const;
+    int maxBucketLoad() const;
+    // heap bytes held by the grid arrays
+    size_t memoryBytes() const;
+
+private:
+    uint32_t bucketOf(int cx, int cy, int cz) const;
+
+    float _cell_size;
+    uint32_t _mask;
+
+    std::vector<uint32_t> _bucket_start;  // size buckets+1, prefix sum of counts
+    std::vector<int> _entries;  // particle indices grouped by bucket
+    std::vector<uint32_t> _particle_bucket;
+};
+
+
+#endif //A3_SPATIALGRID_H
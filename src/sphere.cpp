@@ -1,5 +1,7 @@
 #include "sphere.h"
 
+#include <cmath>
+
 Sphere::Sphere(Vector3f center, float radius) {
     _center = center;
     _radius = radius;
@@ -13,10 +15,9 @@ Sphere::Sphere(Vector3f center, float radius) {
  * @param hit to be modified on intersection
  * @return if intersecting or not
  */
-bool Sphere::intersectsWall(Wall wall, Hit& hit) {
-    // find closest point on plane to center of sphere, calculate if distance greater than radius
-    Vector3f sphere_to_any_point = _center - Vector3f(wall._xmin, wall._ymin, wall._zmin);
-    float dist = abs(Vector3f::dot(sphere_to_any_point, wall._normal));  // dot to normal gives shortest distance
+bool Sphere::intersectsWall(const Wall& wall, Hit& hit) {
+    // signed distance from the center to the plane n.x + d = 0, calculate if greater than radius
+    float dist = fabsf(Vector3f::dot(_center, wall._normal) + wall._d);
 
     // intersection
     if (dist <= _radius) {
@@ -65,6 +66,41 @@ bool Sphere::intersectsSphere(Sphere other, Hit& hit) {
 }
 
 
+/**
+ *
+ * @param other sphere to check intersection
+ * @param hit to be modified on intersection, response for this sphere
+ * @param other_hit to be modified on intersection, response for the other sphere
+ * @return if intersecting or not
+ */
+bool Sphere::intersectsSpherePair(const Sphere& other, Hit& hit, Hit& other_hit) const {
+    Vector3f to_other = other._center - _center;
+    float dist_sq = to_other.absSquared();
+    float radii_dist = _radius + other._radius;
+
+    if (dist_sq >= (radii_dist + 0.001f) * (radii_dist + 0.001f)) {
+        return false;
+    }
+    float dist_to_other = sqrtf(dist_sq);
+
+    // equal and opposite directions
+    Vector3f dir = to_other / dist_to_other;
+    hit.resolveDirection = -dir;
+    other_hit.resolveDirection = dir;
+
+    // distance from each center to the intersecting circle, see intersectsSphere
+    float radii_term = (_radius * _radius - other._radius * other._radius) / (2 * dist_sq);
+    float h = 1.0f/2 + radii_term;
+    float other_h = 1.0f/2 - radii_term;
+    hit.resolveDist = abs(_radius - fabsf(h) * dist_to_other);
+    other_hit.resolveDist = abs(other._radius - fabsf(other_h) * dist_to_other);
+
+    hit.wasHit = true;
+    other_hit.wasHit = true;
+    return true;
+}
+
+
 void Sphere::updateCenter(Vector3f center) {
     _center = center;
 }
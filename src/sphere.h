@@ -8,15 +8,34 @@ class Sphere {
 public:
     Sphere(Vector3f center, float radius);
 
-    bool intersectsWall(Wall wall, Hit& hit);
+    bool intersectsWall(const Wall& wall, Hit& hit);
     bool intersectsSphere(Sphere other, Hit& hit);
     bool intersectsSphere(Sphere other);
+    // both sides of one contact from a single distance computation, same results
+    // as intersectsSphere called from each end
+    bool intersectsSpherePair(const Sphere& other, Hit& hit, Hit& other_hit) const;
     void updateCenter(Vector3f center);
 
+    const Vector3f& center() const { return _center; }
+    float radius() const { return _radius; }
+
 private:
     Vector3f _center;
     float _radius;
 };
 
+// centers and radii of count balls as parallel arrays, the way BallSystem
+// keeps them; Sphere values are only made on the fly for the contact tests
+struct SphereSet {
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* radius;
+    int count;
+
+    Vector3f center(int i) const { return Vector3f(x[i], y[i], z[i]); }
+    Sphere sphere(int i) const { return Sphere(center(i), radius[i]); }
+};
+
 
 #endif //A3_SPHERE_H
@@ -0,0 +1,303 @@
+#include "springsystem.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "threadpool.h"
+#include "vertexrecorder.h"
+
+const Vector3f GRAVITY(0, -9.8f, 0);
+const float FLOOR_Y = -3;
+const float FLOOR_STIFFNESS = 2000;
+const Vector3f SPRING_COLOR(0.9f, 0.8f, 0.3f);
+
+// below this many springs the thread pool costs more than it saves
+const int PARALLEL_SPRINGS = 20000;
+
+Spring::Spring(int end1, int end2, float rest_length, float stiffness)
+    : end1(end1), end2(end2), rest_length(rest_length), stiffness(stiffness)
+{
+}
+
+
+SpringSystem::SpringSystem(const std::vector<Vector3f>& positions, const std::vector<Spring>& springs,
+                           float particle_mass, float drag)
+{
+    _mass = particle_mass;
+    _drag = drag;
+
+    for (const Vector3f& p : positions) {
+        m_vVecState.push_back(p);
+        m_vVecState.emplace_back(0, 0, 0);
+    }
+    _fixed.assign(positions.size(), 0);
+
+    // sort by lower endpoint so the force loop walks positions roughly in order
+    std::vector<Spring> sorted = springs;
+    for (Spring& s : sorted) {
+        if (s.end1 > s.end2) {
+            std::swap(s.end1, s.end2);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Spring& a, const Spring& b) {
+        return a.end1 != b.end1 ? a.end1 < b.end1 : a.end2 < b.end2;
+    });
+    for (const Spring& s : sorted) {
+        _end1.push_back(s.end1);
+        _end2.push_back(s.end2);
+        _rest.push_back(s.rest_length);
+        _stiffness.push_back(s.stiffness);
+    }
+
+    // incidence lists, counting sort by particle
+    int n = (int)positions.size();
+    int m = (int)sorted.size();
+    _inc_start.assign(n + 1, 0);
+    for (int s=0; s<m; s++) {
+        _inc_start[_end1[s] + 1] += 1;
+        _inc_start[_end2[s] + 1] += 1;
+    }
+    for (int p=0; p<n; p++) {
+        _inc_start[p + 1] += _inc_start[p];
+    }
+    _inc_spring.resize(2 * m);
+    _inc_sign.resize(2 * m);
+    std::vector<int> fill(_inc_start.begin(), _inc_start.end() - 1);
+    for (int s=0; s<m; s++) {
+        _inc_spring[fill[_end1[s]]] = s;
+        _inc_sign[fill[_end1[s]]++] = 1;
+        _inc_spring[fill[_end2[s]]] = s;
+        _inc_sign[fill[_end2[s]]++] = -1;
+    }
+    _fx.resize(m);
+    _fy.resize(m);
+    _fz.resize(m);
+}
+
+
+SpringSystem* SpringSystem::makeCloth(int w, int h, float spacing, float stiffness)
+{
+    std::vector<Vector3f> positions;
+    std::vector<Spring> springs;
+    float x0 = -(w - 1) * spacing / 2;
+    for (int r=0; r<h; r++) {
+        for (int c=0; c<w; c++) {
+            positions.emplace_back(x0 + c * spacing, 2, r * spacing);
+        }
+    }
+    float diag = spacing * sqrtf(2.0f);
+    for (int r=0; r<h; r++) {
+        for (int c=0; c<w; c++) {
+            int i = r * w + c;
+            if (c + 1 < w) springs.emplace_back(i, i + 1, spacing, stiffness);  // structural
+            if (r + 1 < h) springs.emplace_back(i, i + w, spacing, stiffness);
+            if (c + 1 < w && r + 1 < h) springs.emplace_back(i, i + w + 1, diag, stiffness);  // shear
+            if (c > 0 && r + 1 < h) springs.emplace_back(i, i + w - 1, diag, stiffness);
+            if (c + 2 < w) springs.emplace_back(i, i + 2, 2 * spacing, stiffness / 4);  // bend
+            if (r + 2 < h) springs.emplace_back(i, i + 2 * w, 2 * spacing, stiffness / 4);
+        }
+    }
+
+    SpringSystem* cloth = new SpringSystem(positions, springs, 0.1f, 0.2f);
+    cloth->_fixed[0] = 1;
+    cloth->_fixed[w - 1] = 1;
+    return cloth;
+}
+
+
+SpringSystem* SpringSystem::makeJellyCube(int n, float spacing, float stiffness)
+{
+    std::vector<Vector3f> positions;
+    std::vector<Spring> springs;
+    float x0 = -(n - 1) * spacing / 2;
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<n; j++) {
+            for (int k=0; k<n; k++) {
+                positions.emplace_back(x0 + i * spacing, 1 + j * spacing, x0 + k * spacing);
+            }
+        }
+    }
+    // tie every particle to its forward half of the 26-neighborhood, so each pair appears once
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<n; j++) {
+            for (int k=0; k<n; k++) {
+                int a = (i * n + j) * n + k;
+                for (int di=0; di<=1; di++) {
+                    for (int dj=-1; dj<=1; dj++) {
+                        for (int dk=-1; dk<=1; dk++) {
+                            if (di == 0 && (dj < 0 || (dj == 0 && dk <= 0))) {
+                                continue;
+                            }
+                            int ni = i + di, nj = j + dj, nk = k + dk;
+                            if (ni >= n || nj < 0 || nj >= n || nk < 0 || nk >= n) {
+                                continue;
+                            }
+                            int b = (ni * n + nj) * n + nk;
+                            float rest = spacing * sqrtf((float)(di * di + dj * dj + dk * dk));
+                            springs.emplace_back(a, b, rest, stiffness);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return new SpringSystem(positions, springs, 0.1f, 0.1f);
+}
+
+
+void SpringSystem::springForces(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a)
+{
+    int m = numSprings();
+    int n = (int)x.size() / 2;
+    // stage positions once per particle, so the spring loop gathers a single
+    // stream instead of position and stage offset for both ends of every spring
+    _stage_pos.resize(n);
+    for (int p=0; p<n; p++) {
+        const Vector3f& xp = x[2*p];
+        if (k) {
+            const Vector3f& kp = (*k)[2*p];
+            _stage_pos[p] = Vector3f(xp[0] + a * kp[0], xp[1] + a * kp[1], xp[2] + a * kp[2]);
+        } else {
+            _stage_pos[p] = xp;
+        }
+    }
+    const Vector3f* pos = _stage_pos.data();
+    auto body = [&](int worker, int begin, int end) {
+        // flat SoA loop, no branches besides the degenerate length guard
+        for (int s=begin; s<end; s++) {
+            const Vector3f& pa = pos[_end1[s]];
+            const Vector3f& pb = pos[_end2[s]];
+            float dx = pb[0] - pa[0];
+            float dy = pb[1] - pa[1];
+            float dz = pb[2] - pa[2];
+            float len = sqrtf(dx * dx + dy * dy + dz * dz);
+            float scale = len > 0 ? _stiffness[s] * (len - _rest[s]) / len : 0;
+            _fx[s] = scale * dx;
+            _fy[s] = scale * dy;
+            _fz[s] = scale * dz;
+        }
+    };
+    if (m >= PARALLEL_SPRINGS) {
+        ThreadPool::shared().parallelFor(m, body);
+    } else {
+        body(0, 0, m);
+    }
+}
+
+
+std::vector<Vector3f> SpringSystem::evalF(const std::vector<Vector3f>& state)
+{
+    std::vector<Vector3f> f;
+    evalFInto(state, f);
+    return f;
+}
+
+
+void SpringSystem::evalFInto(const std::vector<Vector3f>& state, std::vector<Vector3f>& f)
+{
+    f.resize(state.size());
+    evalStage(state, nullptr, 0, f, nullptr, 0, false);
+}
+
+
+void SpringSystem::evalFStage(float a, const std::vector<Vector3f>& kin, std::vector<Vector3f>& kout,
+                              std::vector<Vector3f>& sum, float w, bool accumulate)
+{
+    kout.resize(m_vVecState.size());
+    sum.resize(m_vVecState.size());
+    evalStage(m_vVecState, a == 0 ? nullptr : &kin, a, kout, &sum, w, accumulate);
+}
+
+
+void SpringSystem::evalStage(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a,
+                             std::vector<Vector3f>& f, std::vector<Vector3f>* sum, float w, bool accumulate)
+{
+    springForces(x, k, a);
+
+    int n = (int)x.size() / 2;
+    auto body = [&](int worker, int begin, int end) {
+        for (int p=begin; p<end; p++) {
+            if (_fixed[p]) {
+                f[2*p] = Vector3f(0, 0, 0);
+                f[2*p+1] = Vector3f(0, 0, 0);
+            } else {
+                Vector3f vel = k ? x[2*p+1] + a * (*k)[2*p+1] : x[2*p+1];
+                Vector3f force = _mass * GRAVITY - _drag * vel;
+                for (int e=_inc_start[p]; e<_inc_start[p + 1]; e++) {
+                    int s = _inc_spring[e];
+                    force += _inc_sign[e] * Vector3f(_fx[s], _fy[s], _fz[s]);
+                }
+                float below = FLOOR_Y - _stage_pos[p][1];
+                if (below > 0) {
+                    force[1] += FLOOR_STIFFNESS * below - _drag * 10 * vel[1];
+                }
+                f[2*p] = vel;
+                f[2*p+1] = force / _mass;
+            }
+            if (sum) {
+                std::vector<Vector3f>& acc = *sum;
+                acc[2*p] = accumulate ? acc[2*p] + w * f[2*p] : w * f[2*p];
+                acc[2*p+1] = accumulate ? acc[2*p+1] + w * f[2*p+1] : w * f[2*p+1];
+            }
+        }
+    };
+    if (numSprings() >= PARALLEL_SPRINGS) {
+        ThreadPool::shared().parallelFor(n, body);
+    } else {
+        body(0, 0, n);
+    }
+}
+
+
+void SpringSystem::jacobianProduct(const std::vector<Vector3f>& state, const std::vector<Vector3f>& f,
+                                   const std::vector<Vector3f>& dstate, std::vector<Vector3f>& out)
+{
+    int n = (int)state.size() / 2;
+    out.assign(state.size(), Vector3f(0, 0, 0));
+
+    // spring i-j: K = k [ max(0, 1 - r/l) (I - u u^T) + u u^T ], df_i = K (dx_j - dx_i)
+    for (int s=0; s<numSprings(); s++) {
+        int a = _end1[s];
+        int b = _end2[s];
+        Vector3f d = state[2*b] - state[2*a];
+        float len = d.abs();
+        if (len <= 0) {
+            continue;
+        }
+        Vector3f u = d / len;
+        Vector3f ddx = dstate[2*b] - dstate[2*a];
+        float along = Vector3f::dot(u, ddx);
+        float transverse = fmaxf(0.0f, 1 - _rest[s] / len);
+        Vector3f df = _stiffness[s] * (transverse * (ddx - along * u) + along * u);
+        out[2*a+1] += df;
+        out[2*b+1] -= df;
+    }
+    for (int p=0; p<n; p++) {
+        if (_fixed[p]) {
+            out[2*p+1] = Vector3f(0, 0, 0);
+            continue;
+        }
+        Vector3f dforce = out[2*p+1] - _drag * dstate[2*p+1];
+        if (FLOOR_Y - state[2*p][1] > 0) {
+            dforce[1] += -FLOOR_STIFFNESS * dstate[2*p][1] - _drag * 10 * dstate[2*p+1][1];
+        }
+        out[2*p] = dstate[2*p+1];
+        out[2*p+1] = dforce / _mass;
+    }
+}
+
+
+void SpringSystem::draw(GLProgram& gl)
+{
+    gl.disableLighting();
+    gl.updateModelMatrix(Matrix4f::identity()); // update uniforms after mode change
+
+    VertexRecorder rec(2 * numSprings());
+    for (int s=0; s<numSprings(); s++) {
+        rec.record_poscolor(m_vVecState[2 * _end1[s]], SPRING_COLOR);
+        rec.record_poscolor(m_vVecState[2 * _end2[s]], SPRING_COLOR);
+    }
+    glLineWidth(1.0f);
+    rec.draw(GL_LINES);
+    gl.enableLighting();
+}
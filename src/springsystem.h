@@ -0,0 +1,83 @@
+#ifndef A3_SPRINGSYSTEM_H
+#define A3_SPRINGSYSTEM_H
+
+#include <vector>
+
+#include "particlesystem.h"
+
+class Spring {
+public:
+    Spring(int end1, int end2, float rest_length, float stiffness);
+
+    int end1;
+    int end2;
+
+    float rest_length;
+    float stiffness;
+};
+
+/**
+ * Mass-spring network (cloth, soft bodies). Springs are stored SoA sorted by
+ * their lower endpoint, and each particle owns a CSR run of incident springs:
+ * forces are computed once per spring in a flat loop, then gathered per
+ * particle without write conflicts. State layout matches BallSystem
+ * (position at even indices, velocity at odd).
+ */
+class SpringSystem final : public ParticleSystem
+{
+public:
+    SpringSystem(const std::vector<Vector3f>& positions, const std::vector<Spring>& springs,
+                 float particle_mass, float drag);
+
+    // w x h cloth hanging from its two top corners, structural, shear and bend springs
+    static SpringSystem* makeCloth(int w, int h, float spacing, float stiffness);
+    // n x n x n cube of particles, each tied to its 26 neighbors, dropped onto the floor
+    static SpringSystem* makeJellyCube(int n, float spacing, float stiffness);
+
+    std::vector<Vector3f> evalF(const std::vector<Vector3f>& state) override;
+    void evalFInto(const std::vector<Vector3f>& state, std::vector<Vector3f>& f) override;
+    void evalFStage(float a, const std::vector<Vector3f>& kin, std::vector<Vector3f>& kout,
+                    std::vector<Vector3f>& sum, float w, bool accumulate) override;
+
+    // analytic spring and drag Jacobian, compressed springs clamped so the
+    // implicit solve stays positive definite
+    void jacobianProduct(const std::vector<Vector3f>& state, const std::vector<Vector3f>& f,
+                         const std::vector<Vector3f>& dstate, std::vector<Vector3f>& out) override;
+
+    // the whole network as one line batch
+    void draw(GLProgram&) override;
+
+    int numSprings() const { return (int)_rest.size(); }
+
+    double kineticEnergy() const override { return _mass * ParticleSystem::kineticEnergy(); }
+
+    std::vector<char> _fixed;  // pinned particles never move
+
+private:
+    // per-spring force on end1 (end2 gets the negative) into _fx/_fy/_fz,
+    // at the state x + a * k (k null for x itself)
+    void springForces(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a);
+    // derivative at x + a * k into f, summed into sum per particle when given
+    void evalStage(const std::vector<Vector3f>& x, const std::vector<Vector3f>* k, float a,
+                   std::vector<Vector3f>& f, std::vector<Vector3f>* sum, float w, bool accumulate);
+
+    float _mass;
+    float _drag;
+
+    // springs, SoA, sorted by (end1, end2) with end1 < end2
+    std::vector<int> _end1;
+    std::vector<int> _end2;
+    std::vector<float> _rest;
+    std::vector<float> _stiffness;
+
+    // CSR incidence: particle p owns [_inc_start[p], _inc_start[p+1])
+    std::vector<int> _inc_start;
+    std::vector<int> _inc_spring;
+    std::vector<float> _inc_sign;  // +1 where p is end1, -1 where it is end2
+
+    std::vector<float> _fx, _fy, _fz;
+    std::vector<Vector3f> _stage_pos;  // positions of the state being evaluated
+};
+
+
+#endif //A3_SPRINGSYSTEM_H
@@ -0,0 +1,92 @@
+#include "steparena.h"
+
+#include <cstdio>
+
+#include "largearray.h"
+
+StepArena::StepArena() :
+    _used(0),
+    _wide_used(0),
+    _bytes(0),
+    _high_buffers(0),
+    _high_bytes(0),
+    _allocations(0)
+{
+}
+
+void StepArena::reset()
+{
+    _used = 0;
+    _wide_used = 0;
+    _bytes = 0;
+}
+
+std::vector<Vector3f>& StepArena::take(size_t n)
+{
+    if (_used == (int)_buffers.size()) {
+        _buffers.emplace_back();
+    }
+    std::vector<Vector3f>& buffer = _buffers[_used++];
+    if (buffer.capacity() < n) {
+        _allocations++;
+        reserveLargeArray(buffer, n);
+    }
+    buffer.resize(n);
+
+    _bytes += n * sizeof(Vector3f);
+    if (_used + _wide_used > _high_buffers) {
+        _high_buffers = _used + _wide_used;
+    }
+    if (_bytes > _high_bytes) {
+        _high_bytes = _bytes;
+    }
+    return buffer;
+}
+
+std::vector<Vec3<double>>& StepArena::takeWide(size_t n)
+{
+    if (_wide_used == (int)_wide_buffers.size()) {
+        _wide_buffers.emplace_back();
+    }
+    std::vector<Vec3<double>>& buffer = _wide_buffers[_wide_used++];
+    if (buffer.capacity() < n) {
+        _allocations++;
+        reserveLargeArray(buffer, n);
+    }
+    buffer.resize(n);
+
+    _bytes += n * sizeof(Vec3<double>);
+    if (_used + _wide_used > _high_buffers) {
+        _high_buffers = _used + _wide_used;
+    }
+    if (_bytes > _high_bytes) {
+        _high_bytes = _bytes;
+    }
+    return buffer;
+}
+
+void StepArena::rewind(int m)
+{
+    for (int i=m; i<_used; i++) {
+        _bytes -= _buffers[i].size() * sizeof(Vector3f);
+    }
+    _used = m;
+}
+
+size_t StepArena::capacityBytes() const
+{
+    size_t bytes = 0;
+    for (const std::vector<Vector3f>& buffer : _buffers) {
+        bytes += buffer.capacity() * sizeof(Vector3f);
+    }
+    for (const std::vector<Vec3<double>>& buffer : _wide_buffers) {
+        bytes += buffer.capacity() * sizeof(Vec3<double>);
+    }
+    return bytes;
+}
+
+void StepArena::printStats(const char* label) const
+{
+    printf("%s step arena: high water %d buffers, %.2f MB, %ld heap allocations\n",
+           label, _high_buffers, _high_bytes / 1048576.0, _allocations);
+}
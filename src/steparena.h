@@ -0,0 +1,63 @@
+#ifndef A3_STEPARENA_H
+#define A3_STEPARENA_H
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <vecmath.h>
+
+#include "vec3.h"
+
+/**
+ * Scratch state vectors for one time step. Steppers and systems take their
+ * temporaries (state copies, derivatives, stage sums) from the arena instead
+ * of constructing vectors, and the stepper resets it at the start of every
+ * takeStep, which hands the same buffers out again in the same order. Buffers
+ * keep their capacity, so once a step of a given size has run the step loop
+ * no longer touches the heap. It hands out whole vectors rather than bumping
+ * a raw byte pointer so temporaries keep the std::vector interface evalF and
+ * evalFStage use.
+ */
+class StepArena {
+public:
+    StepArena();
+
+    // every buffer taken since the last reset becomes free again
+    void reset();
+
+    // a buffer of n entries, valid until the next reset; contents unspecified
+    std::vector<Vector3f>& take(size_t n);
+    // the same for double state (steppers integrating in double); not
+    // affected by mark/rewind, handed back at reset
+    std::vector<Vec3<double>>& takeWide(size_t n);
+
+    // hand back everything taken after mark() returned m, for temporaries of
+    // calls made many times per step (e.g. every CG iteration)
+    int mark() const { return _used; }
+    void rewind(int m);
+
+    int buffersInUse() const { return _used; }
+    size_t bytesInUse() const { return _bytes; }
+    // most buffers and bytes any one step has held
+    int highWaterBuffers() const { return _high_buffers; }
+    size_t highWaterBytes() const { return _high_bytes; }
+    // heap allocations the arena has made, flat once every size has been seen
+    long heapAllocations() const { return _allocations; }
+    // heap bytes held by all pooled buffers, in use or not
+    size_t capacityBytes() const;
+
+    void printStats(const char* label) const;
+
+private:
+    std::deque<std::vector<Vector3f>> _buffers;  // references stay valid as it grows
+    int _used;
+    std::deque<std::vector<Vec3<double>>> _wide_buffers;
+    int _wide_used;
+    size_t _bytes;
+    int _high_buffers;
+    size_t _high_bytes;
+    long _allocations;
+};
+
+
+#endif //A3_STEPARENA_H
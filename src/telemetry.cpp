@@ -0,0 +1,259 @@
+#include "telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0  // no per-call flag on macOS
+#endif
+
+static_assert(sizeof(TelemetryStats) % sizeof(uint64_t) == 0, "telemetry stats must be whole words");
+
+// longest command line, and output a client may have queued before streamed
+// snapshots are skipped for it
+const size_t MAX_COMMAND = 256;
+const size_t MAX_PENDING_OUTPUT = 64 * 1024;
+// server wakeup interval when idle, also bounds how long stop() waits
+const int POLL_MS = 10;
+const int MIN_STREAM_MS = 10;
+
+TelemetryServer::TelemetryServer() : _listen_fd(-1), _quit(false), _sequence(0)
+{
+    for (int w=0; w<WORDS; w++) {
+        _words[w].store(0, std::memory_order_relaxed);
+    }
+}
+
+TelemetryServer::~TelemetryServer()
+{
+    stop();
+}
+
+void TelemetryServer::publish(const TelemetryStats& stats)
+{
+    uint64_t words[WORDS];
+    memcpy(words, &stats, sizeof(words));
+    uint64_t seq = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int w=0; w<WORDS; w++) {
+        _words[w].store(words[w], std::memory_order_relaxed);
+    }
+    _sequence.store(seq + 2, std::memory_order_release);
+}
+
+bool TelemetryServer::read(TelemetryStats& stats) const
+{
+    uint64_t words[WORDS];
+    while (true) {
+        uint64_t before = _sequence.load(std::memory_order_acquire);
+        if (before == 0) {
+            return false;
+        }
+        if (before & 1) {
+            continue;  // publish in progress
+        }
+        for (int w=0; w<WORDS; w++) {
+            words[w] = _words[w].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+    }
+    memcpy(&stats, words, sizeof(words));
+    return true;
+}
+
+static std::string statsJson(const TelemetryStats& s)
+{
+    char line[512];
+    snprintf(line, sizeof(line),
+             "{\"step\":%llu,\"simulated_s\":%.6f,\"steps_per_s\":%.1f,\"particles\":%llu,"
+             "\"kinetic_energy\":%.6g,\"step_ms\":%.4f,\"simulate_ms\":%.3f,\"draw_ms\":%.3f,"
+             "\"frame_ms\":%.3f,\"paused\":%s,\"arena_bytes\":%llu}\n",
+             (unsigned long long)s.step, s.simulated_s, s.steps_per_s, (unsigned long long)s.particles,
+             s.kinetic_energy, s.step_ms, s.simulate_ms, s.draw_ms, s.frame_ms, s.paused ? "true" : "false",
+             (unsigned long long)s.arena_bytes);
+    return line;
+}
+
+#ifdef _WIN32
+
+bool TelemetryServer::start(const std::string& path)
+{
+    printf("Telemetry sockets are not supported on this platform\n");
+    return false;
+}
+
+void TelemetryServer::stop()
+{
+}
+
+void TelemetryServer::run()
+{
+}
+
+#else
+
+bool TelemetryServer::start(const std::string& path)
+{
+    stop();
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        printf("Telemetry socket path %s is too long\n", path.c_str());
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+
+    _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_listen_fd < 0) {
+        printf("Cannot create telemetry socket\n");
+        return false;
+    }
+    unlink(path.c_str());
+    if (bind(_listen_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(_listen_fd, 8) != 0) {
+        printf("Cannot listen on %s\n", path.c_str());
+        close(_listen_fd);
+        _listen_fd = -1;
+        return false;
+    }
+    fcntl(_listen_fd, F_SETFL, O_NONBLOCK);
+    _path = path;
+    _quit = false;
+    _thread = std::thread(&TelemetryServer::run, this);
+    printf("Telemetry on %s\n", path.c_str());
+    return true;
+}
+
+void TelemetryServer::stop()
+{
+    if (!_thread.joinable()) {
+        return;
+    }
+    _quit = true;
+    _thread.join();
+    close(_listen_fd);
+    _listen_fd = -1;
+    unlink(_path.c_str());
+}
+
+namespace {
+struct Client {
+    int fd;
+    std::string input;  // partial command line
+    std::string output;  // not yet accepted by the socket
+    int stream_ms;  // 0 when not streaming
+    std::chrono::steady_clock::time_point next_stream;
+};
+}
+
+void TelemetryServer::run()
+{
+    using namespace std::chrono;
+    std::vector<Client> clients;
+    std::vector<pollfd> fds;
+    while (!_quit) {
+        fds.clear();
+        fds.push_back({_listen_fd, POLLIN, 0});
+        for (const Client& c : clients) {
+            fds.push_back({c.fd, (short)(POLLIN | (c.output.empty() ? 0 : POLLOUT)), 0});
+        }
+        poll(fds.data(), fds.size(), POLL_MS);
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(_listen_fd, nullptr, nullptr)) >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                Client c;
+                c.fd = fd;
+                c.stream_ms = 0;
+                clients.push_back(c);
+                fds.push_back({fd, 0, 0});
+            }
+        }
+
+        steady_clock::time_point now = steady_clock::now();
+        for (size_t k=0; k<clients.size(); k++) {
+            Client& c = clients[k];
+            bool closed = false;
+            if (fds[k + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char chunk[512];
+                ssize_t got;
+                while ((got = recv(c.fd, chunk, sizeof(chunk), 0)) > 0) {
+                    c.input.append(chunk, got);
+                }
+                closed = got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+            }
+
+            // complete command lines
+            size_t newline;
+            while ((newline = c.input.find('\n')) != std::string::npos) {
+                std::string command = c.input.substr(0, newline);
+                c.input.erase(0, newline + 1);
+                if (!command.empty() && command.back() == '\r') {
+                    command.pop_back();
+                }
+                TelemetryStats stats;
+                if (command == "stats") {
+                    c.output += read(stats) ? statsJson(stats) : "{\"error\":\"no data yet\"}\n";
+                } else if (command.compare(0, 7, "stream ") == 0) {
+                    c.stream_ms = std::max(MIN_STREAM_MS, atoi(command.c_str() + 7));
+                    c.next_stream = now;
+                } else if (command == "stop") {
+                    c.stream_ms = 0;
+                } else if (!command.empty()) {
+                    c.output += "{\"error\":\"commands are stats, stream <ms>, stop\"}\n";
+                }
+            }
+            if (c.input.size() > MAX_COMMAND) {
+                closed = true;  // not a telemetry client
+            }
+
+            if (c.stream_ms > 0 && now >= c.next_stream) {
+                TelemetryStats stats;
+                if (c.output.size() < MAX_PENDING_OUTPUT && read(stats)) {
+                    c.output += statsJson(stats);
+                }
+                c.next_stream = now + milliseconds(c.stream_ms);
+            }
+
+            while (!closed && !c.output.empty()) {
+                ssize_t sent = send(c.fd, c.output.data(), c.output.size(), MSG_NOSIGNAL);
+                if (sent > 0) {
+                    c.output.erase(0, sent);
+                } else {
+                    closed = sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+                    break;
+                }
+            }
+
+            if (closed) {
+                close(c.fd);
+                clients.erase(clients.begin() + k);
+                fds.erase(fds.begin() + k + 1);
+                k--;
+            }
+        }
+    }
+    for (const Client& c : clients) {
+        close(c.fd);
+    }
+}
+
+#endif
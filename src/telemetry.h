@@ -0,0 +1,69 @@
+#ifndef A3_TELEMETRY_H
+#define A3_TELEMETRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+/**
+ * Per-frame metrics of a running simulation. Only 8-byte fields, so the
+ * struct travels through the seqlock as whole atomic words.
+ */
+struct TelemetryStats {
+    uint64_t step;
+    double simulated_s;
+    double steps_per_s;  // over the last frame
+    uint64_t particles;
+    double kinetic_energy;
+    // phase timings of the last frame, in milliseconds
+    double step_ms;  // per step, averaged over the frame's steps
+    double simulate_ms;  // all steps of the frame
+    double draw_ms;
+    double frame_ms;
+    uint64_t paused;
+    uint64_t arena_bytes;  // step arena high water mark
+};
+
+/**
+ * Local telemetry endpoint on a Unix domain socket. A background thread
+ * polls the listening socket and its clients without blocking and answers
+ * line commands with one JSON object per line:
+ *   stats         the latest snapshot
+ *   stream <ms>   a snapshot every ms milliseconds (10 at least) until stop
+ *   stop          ends a stream
+ * The simulation thread calls publish() once per frame: a seqlock over atomic
+ * words, so it never takes a lock or waits for the server. A slow client
+ * misses streamed snapshots instead of holding the server up.
+ * Try: socat - UNIX-CONNECT:/tmp/a3.sock
+ */
+class TelemetryServer {
+public:
+    TelemetryServer();
+    ~TelemetryServer();
+
+    // listen on path (an existing socket file there is replaced), false on error
+    bool start(const std::string& path);
+    void stop();
+    bool isOpen() const { return _thread.joinable(); }
+
+    void publish(const TelemetryStats& stats);
+
+    // latest consistent snapshot, false if nothing was published yet
+    bool read(TelemetryStats& stats) const;
+
+private:
+    static const int WORDS = sizeof(TelemetryStats) / sizeof(uint64_t);
+
+    void run();
+
+    std::string _path;
+    int _listen_fd;
+    std::thread _thread;
+    std::atomic<bool> _quit;
+    std::atomic<uint64_t> _sequence;  // odd while publish is writing
+    std::atomic<uint64_t> _words[WORDS];
+};
+
+
+#endif //A3_TELEMETRY_H
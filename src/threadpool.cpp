@@ -0,0 +1,92 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cassert>
+
+// set while this thread runs a chunk of any pool, to catch nested parallelFor
+static thread_local bool in_parallel_for = false;
+
+ThreadPool::ThreadPool(int num_threads) {
+    _job = nullptr;
+    _count = 0;
+    _generation = 0;
+    _pending = 0;
+    _stop = false;
+    for (int w=1; w<num_threads; w++) {
+        _threads.emplace_back(&ThreadPool::workerLoop, this, w);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& t : _threads) {
+        t.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+void ThreadPool::runChunk(int worker) {
+    int workers = size();
+    int begin = (int)((long long)_count * worker / workers);
+    int end = (int)((long long)_count * (worker + 1) / workers);
+    if (begin < end) {
+        in_parallel_for = true;
+        (*_job)(worker, begin, end);
+        in_parallel_for = false;
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int, int)>& fn) {
+    assert(!in_parallel_for && "nested ThreadPool::parallelFor");
+    if (_threads.empty()) {
+        if (count > 0) {
+            in_parallel_for = true;
+            fn(0, 0, count);
+            in_parallel_for = false;
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _job = &fn;
+        _count = count;
+        _pending = (int)_threads.size();
+        _generation += 1;
+    }
+    _wake.notify_all();
+
+    runChunk(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _pending == 0; });
+    _job = nullptr;
+}
+
+void ThreadPool::workerLoop(int worker) {
+    int seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _stop || _generation != seen; });
+            if (_stop) {
+                return;
+            }
+            seen = _generation;
+        }
+
+        runChunk(worker);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_pending == 0) {
+            _done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef A3_THREADPOOL_H
+#define A3_THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads for data-parallel loops. parallelFor splits a
+ * range into one contiguous chunk per worker (the calling thread is worker 0),
+ * so the same count always gives the same chunks and results stay deterministic.
+ *
+ * parallelFor is not reentrant: a chunk must not call parallelFor again, on
+ * this pool or any other, since a nested job would overwrite the one the
+ * workers are still running. Such a call fails an assert.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    int size() const { return (int)_threads.size() + 1; }
+
+    // run fn(worker, begin, end) over [0, count) split across all workers, returns when every chunk is done;
+    // not from inside another parallelFor
+    void parallelFor(int count, const std::function<void(int, int, int)>& fn);
+
+    // process-wide pool with one worker per hardware thread
+    static ThreadPool& shared();
+
+private:
+    void workerLoop(int worker);
+    void runChunk(int worker);
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+
+    const std::function<void(int, int, int)>* _job;
+    int _count;
+    int _generation;  // bumped per parallelFor so workers run each job once
+    int _pending;
+    bool _stop;
+};
+
+
+#endif //A3_THREADPOOL_H
@@ -1,79 +1,133 @@
 #include "timestepper.h"
+#include "integrators.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 
-void ForwardEuler::takeStep(ParticleSystem *particleSystem, float stepSize) {
-    //TODO: See handout 3.1
-    std::vector<Vector3f> current = particleSystem->getState();
-    std::vector<Vector3f> derivatives = particleSystem->evalF(current);
+// backward Euler solver limits
+const int NEWTON_ITERATIONS = 8;
+const float NEWTON_TOLERANCE = 1e-4f;  // relative to the explicit velocity change
+const int CG_ITERATIONS = 40;
+const float CG_TOLERANCE = 1e-3f;  // relative to the Newton residual
 
-    std::vector<Vector3f> updated;
-    for (int i = 0; i < current.size(); i++) {
-        Vector3f particle = current[i];
-        Vector3f deriv = derivatives[i];
-        float x = particle[0];
-        float x_h = stepSize * deriv[0];
-        float y = particle[1];
-        float y_h = stepSize * deriv[1];
-        float z = particle[2];
-        updated.emplace_back(x + x_h, y + y_h, z);
-    }
-    particleSystem->setState(updated);
+void ForwardEuler::takeStep(ParticleSystem *particleSystem, float stepSize) {
+    forwardEulerStep(*particleSystem, stepSize);
 }
 
 void Trapezoidal::takeStep(ParticleSystem *particleSystem, float stepSize) {
-    //TODO: See handout 3.1
-    std::vector<Vector3f> current = particleSystem->getState();
-    std::vector<Vector3f> f0 = particleSystem->evalF(current);
-
-    std::vector<Vector3f> stepped;
-    for (int i = 0; i < current.size(); i++) {
-        Vector3f particle = current[i];
-        Vector3f deriv = f0[i];
-        float x = particle[0];
-        float x_h = stepSize * deriv[0];
-        float y = particle[1];
-        float y_h = stepSize * deriv[1];
-        float z = particle[2];
+    trapezoidalStep(*particleSystem, stepSize);
+}
 
-        stepped.emplace_back(x + x_h, y + y_h, z);
-    }
-    std::vector<Vector3f> f1 = particleSystem->evalF(stepped);
+void RK4::takeStep(ParticleSystem *particleSystem, float stepSize) {
+    rk4Step(*particleSystem, stepSize);
+}
 
-    std::vector<Vector3f> updated;
-    for (int i = 0; i < current.size(); i++) {
-            Vector3f particle = current[i];
-            Vector3f change = f0[i] + f1[0];
-            change = change * stepSize / 2;
-            updated.push_back(particle + change);
+static float dotState(const std::vector<Vector3f>& a, const std::vector<Vector3f>& b) {
+    float sum = 0;
+    for (size_t i=0; i<a.size(); i++) {
+        sum += Vector3f::dot(a[i], b[i]);
     }
-    particleSystem->setState(updated);
+    return sum;
 }
 
-std::vector<Vector3f> rangeKuttaHelper(std::vector<Vector3f> pos, std::vector<Vector3f> prev_k, ParticleSystem *particleSystem, float stepSize) {
-    std::vector<Vector3f> out;
-    out.reserve(pos.size());
-    for (int i=0;i<pos.size();i++) {
-        out.push_back(pos[i] + stepSize * prev_k[i]);
+// end-of-step state for velocity change dv: x1 = x0 + h (v0 + dv), v1 = v0 + dv
+static void implicitState(const std::vector<Vector3f>& current, const std::vector<Vector3f>& dv, float stepSize, std::vector<Vector3f>& out) {
+    for (size_t i=0; i<dv.size(); i++) {
+        Vector3f v = current[2*i+1] + dv[i];
+        out[2*i] = current[2*i] + stepSize * v;
+        out[2*i+1] = v;
     }
-    return particleSystem->evalF(out);
 }
 
-void RK4::takeStep(ParticleSystem *particleSystem, float stepSize) {
-    std::vector<Vector3f> current = particleSystem->getState();
+void BackwardEuler::takeStep(ParticleSystem *particleSystem, float stepSize) {
+    StepArena& arena = particleSystem->stepArena();
+    arena.reset();
+    particleSystem->beginStep(stepSize);
+    const std::vector<Vector3f>& current = particleSystem->stateRef();
+    size_t n = current.size() / 2;
+
+    // solve R(dv) = dv - h a(x0 + h (v0 + dv), v0 + dv) = 0 for the velocity change.
+    // its Jacobian I - h (h da/dx + da/dv) is symmetric positive definite for springs
+    // and drag, so each Newton update is a conjugate gradient solve
+    std::vector<Vector3f>& dv = arena.take(n);
+    std::fill(dv.begin(), dv.end(), Vector3f(0, 0, 0));
+    std::vector<Vector3f>& state = arena.take(current.size());
+    std::vector<Vector3f>& f = arena.take(current.size());
+    std::vector<Vector3f>& residual = arena.take(n);
+    std::vector<Vector3f>& delta = arena.take(n);
+    std::vector<Vector3f>& r = arena.take(n);
+    std::vector<Vector3f>& p = arena.take(n);
+    std::vector<Vector3f>& ap = arena.take(n);
+    std::vector<Vector3f>& dstate = arena.take(current.size());
+    std::vector<Vector3f>& jp = arena.take(current.size());
 
-    std::vector<Vector3f> k1 = particleSystem->evalF(current);
-    std::vector<Vector3f> k2 = rangeKuttaHelper(current, k1, particleSystem, stepSize/2);
-    std::vector<Vector3f> k3 = rangeKuttaHelper(current, k2, particleSystem, stepSize/2);
-    std::vector<Vector3f> k4 = rangeKuttaHelper(current, k3, particleSystem, stepSize);
+    float scale = 0;
+    bool evaluated = false;  // f holds evalF at the final dv
+    for (int it=0; it<NEWTON_ITERATIONS; it++) {
+        implicitState(current, dv, stepSize, state);
+        particleSystem->evalFInto(state, f);
+        for (size_t i=0; i<n; i++) {
+            residual[i] = dv[i] - stepSize * f[2*i+1];
+        }
+        float residual_norm = sqrtf(dotState(residual, residual));
+        if (it == 0) {
+            scale = residual_norm;  // |h a0|, the explicit Euler velocity change
+        }
+        if (residual_norm <= NEWTON_TOLERANCE * scale || residual_norm == 0) {
+            evaluated = true;
+            break;
+        }
 
-    std::vector<Vector3f> updated;
-    for (int i=0; i<current.size(); i++) {
-        Vector3f change = k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i];
-        change = change * stepSize / 6;
-        updated.push_back(current[i] + change);
+        // CG on J delta = -residual, J w = w - h * (Jf (h w, w)) restricted to velocities
+        for (size_t i=0; i<n; i++) {
+            delta[i] = Vector3f(0, 0, 0);
+            r[i] = -residual[i];
+            p[i] = r[i];
+        }
+        float rr = dotState(r, r);
+        float rr_stop = CG_TOLERANCE * CG_TOLERANCE * rr;
+        for (int k=0; k<CG_ITERATIONS && rr > rr_stop; k++) {
+            for (size_t i=0; i<n; i++) {
+                dstate[2*i] = stepSize * p[i];
+                dstate[2*i+1] = p[i];
+            }
+            particleSystem->jacobianProduct(state, f, dstate, jp);
+            for (size_t i=0; i<n; i++) {
+                ap[i] = p[i] - stepSize * jp[2*i+1];
+            }
+            float pap = dotState(p, ap);
+            if (pap <= 0) {
+                break;  // not positive definite along p (e.g. contact forces), keep what we have
+            }
+            float alpha = rr / pap;
+            for (size_t i=0; i<n; i++) {
+                delta[i] += alpha * p[i];
+                r[i] -= alpha * ap[i];
+            }
+            float rr_next = dotState(r, r);
+            float beta = rr_next / rr;
+            rr = rr_next;
+            for (size_t i=0; i<n; i++) {
+                p[i] = r[i] + beta * p[i];
+            }
+        }
+        for (size_t i=0; i<n; i++) {
+            dv[i] += delta[i];
+        }
     }
 
-    particleSystem->setState(updated);
+    // positions follow the system's own position derivative at the solution
+    // (BallSystem pins resting balls), velocities the solved change
+    if (!evaluated) {
+        implicitState(current, dv, stepSize, state);
+        particleSystem->evalFInto(state, f);
+    }
+    std::vector<Vector3f>& updated = particleSystem->nextState();
+    for (size_t i=0; i<n; i++) {
+        updated[2*i] = current[2*i] + stepSize * f[2*i];
+        updated[2*i+1] = state[2*i+1];
+    }
+    particleSystem->swapState();
+    particleSystem->endStep();
 }
-
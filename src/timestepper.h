@@ -29,7 +29,13 @@ class RK4 : public TimeStepper
 	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
 };
 
-std::vector<Vector3f> rangeKuttaHelper(std::vector<Vector3f> pos, std::vector<Vector3f> prev_k, ParticleSystem *particleSystem, float stepSize);
+// Implicit (backward) Euler for stiff systems. Newton iterations solve for the
+// end-of-step velocity; each linear solve is conjugate gradient on
+// Jacobian-vector products from ParticleSystem::jacobianProduct, no matrix is formed.
+class BackwardEuler : public TimeStepper
+{
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+};
 
 /////////////////////////
 #endif
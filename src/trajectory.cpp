@@ -0,0 +1,235 @@
+#include "trajectory.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "scene.h"
+#include "threadpool.h"
+
+const char TRAJECTORY_MAGIC[8] = {'A', '3', 'T', 'R', 'A', 'J', 0, 0};
+const uint32_t TRAJECTORY_VERSION = 1;
+
+TrajectoryWriter::TrajectoryWriter() : _file(nullptr), _frames(0)
+{
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+bool TrajectoryWriter::open(const std::string& path, const BallSystem& system, float frame_dt)
+{
+    close();
+    _file = fopen(path.c_str(), "wb");
+    if (!_file) {
+        printf("Cannot create trajectory %s\n", path.c_str());
+        return false;
+    }
+    _frames = 0;
+
+    int n = (int)system._ids.size();
+    TrajectoryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+    header.version = TRAJECTORY_VERSION;
+    header.num_particles = n;
+    header.frame_dt = frame_dt;
+    fwrite(&header, sizeof(header), 1, _file);
+
+    // radii, then colors, by creation index
+    std::vector<float> radii(n);
+    std::vector<float> colors(3 * n);
+    for (int i=0; i<n; i++) {
+        int id = system._ids[i];
+        radii[id] = system._radii[i];
+        Vector3f color = system.color(i);
+        for (int k=0; k<3; k++) {
+            colors[3*id + k] = color[k];
+        }
+    }
+    fwrite(radii.data(), sizeof(float), n, _file);
+    fwrite(colors.data(), sizeof(float), 3 * n, _file);
+    _buffer.resize(3 * n);
+    return true;
+}
+
+void TrajectoryWriter::close()
+{
+    if (_file) {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
+
+void TrajectoryWriter::writeFrame(BallSystem& system)
+{
+    if (!_file) {
+        return;
+    }
+    const std::vector<Vector3f>& state = system.stateRef();
+    const std::vector<int>& ids = system._ids;
+    for (size_t i=0; i<ids.size(); i++) {
+        const Vector3f& p = state[2*i];
+        _buffer[3*ids[i]] = p[0];
+        _buffer[3*ids[i] + 1] = p[1];
+        _buffer[3*ids[i] + 2] = p[2];
+    }
+    fwrite(_buffer.data(), sizeof(float), _buffer.size(), _file);
+    fflush(_file);
+    _frames++;
+}
+
+
+TrajectoryReader::TrajectoryReader() :
+    _data(nullptr),
+    _size(0),
+    _radii(nullptr),
+    _colors(nullptr),
+    _positions(nullptr),
+    _frames(0)
+{
+    memset(&_header, 0, sizeof(_header));
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+    close();
+}
+
+bool TrajectoryReader::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    // no mmap: read the whole file
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        printf("Cannot open trajectory %s\n", path.c_str());
+        return false;
+    }
+    char chunk[1 << 16];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        _contents.insert(_contents.end(), chunk, chunk + got);
+    }
+    fclose(f);
+    _data = _contents.data();
+    _size = _contents.size();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        printf("Cannot open trajectory %s\n", path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("Cannot read trajectory %s\n", path.c_str());
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // the mapping keeps the file alive
+    if (mapped == MAP_FAILED) {
+        printf("Cannot map trajectory %s\n", path.c_str());
+        return false;
+    }
+    _data = (const char*)mapped;
+    _size = st.st_size;
+#endif
+
+    if (_size < sizeof(_header)) {
+        printf("%s is not a trajectory file\n", path.c_str());
+        close();
+        return false;
+    }
+    memcpy(&_header, _data, sizeof(_header));
+    size_t n = _header.num_particles;
+    size_t fixed = sizeof(_header) + 4 * sizeof(float) * n;
+    if (memcmp(_header.magic, TRAJECTORY_MAGIC, sizeof(_header.magic)) != 0 ||
+        _header.version != TRAJECTORY_VERSION || n == 0 || _size < fixed || !(_header.frame_dt > 0)) {
+        printf("%s is not a trajectory file\n", path.c_str());
+        close();
+        return false;
+    }
+    _radii = (const float*)(_data + sizeof(_header));
+    _colors = _radii + n;
+    _positions = _colors + 3 * n;
+    _frames = (long)((_size - fixed) / (3 * sizeof(float) * n));  // a partly written last frame is ignored
+    if (_frames == 0) {
+        printf("Trajectory %s has no frames\n", path.c_str());
+        close();
+        return false;
+    }
+    printf("Replaying %s: %d balls, %ld frames, %.2f s\n", path.c_str(), numParticles(), _frames, duration());
+    return true;
+}
+
+void TrajectoryReader::close()
+{
+#ifdef _WIN32
+    _contents.clear();
+#else
+    if (_data) {
+        munmap((void*)_data, _size);
+    }
+#endif
+    _data = nullptr;
+    _size = 0;
+    _frames = 0;
+}
+
+Vector3f TrajectoryReader::position(long frame, int i) const
+{
+    const float* p = _positions + ((size_t)frame * _header.num_particles + i) * 3;
+    return Vector3f(p[0], p[1], p[2]);
+}
+
+BallSystem* TrajectoryReader::makeSystem() const
+{
+    Scene scene;
+    int n = numParticles();
+    scene.state.resize(2 * n, Vector3f(0, 0, 0));
+    scene.radii.assign(_radii, _radii + n);
+    for (int i=0; i<n; i++) {
+        scene.state[2*i] = position(0, i);
+        scene.colors.emplace_back(_colors[3*i], _colors[3*i + 1], _colors[3*i + 2]);
+    }
+    // drawing only: no stepping, so no broadphase either
+    scene.broadphase = BROADPHASE_ALL_PAIRS;
+    scene.reorder_interval = 0;
+    return new BallSystem(_header.frame_dt, scene);
+}
+
+void TrajectoryReader::interpolate(double t, bool cubic, std::vector<Vector3f>& state) const
+{
+    int n = numParticles();
+    state.resize(2 * n);
+
+    double frame = fmin(fmax(t / _header.frame_dt, 0.0), (double)(_frames - 1));
+    long f1 = (long)frame;
+    long f2 = f1 + 1 < _frames ? f1 + 1 : f1;
+    long f0 = f1 > 0 ? f1 - 1 : f1;
+    long f3 = f2 + 1 < _frames ? f2 + 1 : f2;
+    float alpha = (float)(frame - f1);
+
+    // only the pages of the two or four frames around t are touched, whatever
+    // the original run cost to simulate
+    ThreadPool::shared().parallelFor(n, [&](int worker, int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            if (cubic) {
+                state[2*i] = Vector3f::cubicInterpolate(position(f0, i), position(f1, i),
+                                                        position(f2, i), position(f3, i), alpha);
+            } else {
+                state[2*i] = Vector3f::lerp(position(f1, i), position(f2, i), alpha);
+            }
+            state[2*i + 1] = Vector3f(0, 0, 0);
+        }
+    });
+}
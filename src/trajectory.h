@@ -0,0 +1,85 @@
+#ifndef A3_TRAJECTORY_H
+#define A3_TRAJECTORY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <vecmath.h>
+
+#include "ballsystem.h"
+
+/**
+ * Ball trajectory file: a fixed header, per-ball radii and colors, then one
+ * frame of float x, y, z positions per ball every frame_dt simulated seconds.
+ * Balls are stored in creation order (BallSystem::_ids), not the reordered
+ * memory order. There is no frame count in the header: it follows from the
+ * file size, so a run that was killed mid-write still plays back.
+ */
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_particles;
+    float frame_dt;
+    uint32_t reserved;
+};
+
+class TrajectoryWriter {
+public:
+    TrajectoryWriter();
+    ~TrajectoryWriter();
+
+    // create path and write the header, radii and colors of system, false on error
+    bool open(const std::string& path, const BallSystem& system, float frame_dt);
+    void close();
+
+    // append the current positions of system as the next frame
+    void writeFrame(BallSystem& system);
+
+    long numFrames() const { return _frames; }
+
+private:
+    FILE* _file;
+    long _frames;
+    std::vector<float> _buffer;
+};
+
+class TrajectoryReader {
+public:
+    TrajectoryReader();
+    ~TrajectoryReader();
+
+    // map path read-only, false (with a message) if it is not a trajectory
+    bool open(const std::string& path);
+    void close();
+
+    int numParticles() const { return (int)_header.num_particles; }
+    long numFrames() const { return _frames; }
+    float frameDt() const { return _header.frame_dt; }
+    double duration() const { return _frames > 1 ? (double)(_frames - 1) * _header.frame_dt : 0; }
+
+    // a BallSystem with the recorded radii and colors at frame 0, for drawing only
+    BallSystem* makeSystem() const;
+
+    // positions at time t (clamped to the recording) into the even entries of
+    // state, velocities left zero; Catmull-Rom through the four nearest frames
+    // when cubic, else linear between the two around t
+    void interpolate(double t, bool cubic, std::vector<Vector3f>& state) const;
+
+private:
+    Vector3f position(long frame, int i) const;
+
+    const char* _data;
+    size_t _size;
+    TrajectoryHeader _header;
+    const float* _radii;
+    const float* _colors;
+    const float* _positions;
+    long _frames;
+#ifdef _WIN32
+    std::vector<char> _contents;
+#endif
+};
+
+
+#endif //A3_TRAJECTORY_H
@@ -0,0 +1,529 @@
+#include "trianglemesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// BVH build parameters
+const int SAH_BINS = 12;
+const int MIN_LEAF = 2;
+const int MAX_LEAF = 8;
+const int MAX_DEPTH = 48;  // keeps the query stack bounded
+const int QUERY_STACK = 64;
+
+// most vertices a PLY face list may have, anything longer is a corrupt file
+const int MAX_PLY_FACE = 256;
+
+static float surfaceArea(const Vector3f& lo, const Vector3f& hi) {
+    Vector3f e = hi - lo;
+    if (e[0] < 0) {
+        return 0;  // empty box
+    }
+    return 2 * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+}
+
+static void grow(Vector3f& lo, Vector3f& hi, const Vector3f& p) {
+    for (int k=0; k<3; k++) {
+        lo[k] = fminf(lo[k], p[k]);
+        hi[k] = fmaxf(hi[k], p[k]);
+    }
+}
+
+// squared distance from p to the box, 0 inside
+static float boxDistSquared(const Vector3f& p, const Vector3f& lo, const Vector3f& hi) {
+    float d2 = 0;
+    for (int k=0; k<3; k++) {
+        float v = fmaxf(fmaxf(lo[k] - p[k], 0.0f), p[k] - hi[k]);
+        d2 += v * v;
+    }
+    return d2;
+}
+
+
+Vector3f closestPointOnTriangle(const Vector3f& p, const Vector3f& a, const Vector3f& b, const Vector3f& c) {
+    Vector3f ab = b - a;
+    Vector3f ac = c - a;
+    Vector3f ap = p - a;
+    float d1 = Vector3f::dot(ab, ap);
+    float d2 = Vector3f::dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) {
+        return a;  // vertex region a
+    }
+
+    Vector3f bp = p - b;
+    float d3 = Vector3f::dot(ab, bp);
+    float d4 = Vector3f::dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) {
+        return b;  // vertex region b
+    }
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        return a + d1 / (d1 - d3) * ab;  // edge ab
+    }
+
+    Vector3f cp = p - c;
+    float d5 = Vector3f::dot(ab, cp);
+    float d6 = Vector3f::dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) {
+        return c;  // vertex region c
+    }
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        return a + d2 / (d2 - d6) * ac;  // edge ac
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+        return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b);  // edge bc
+    }
+
+    // inside the face
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+
+MeshCollider::MeshCollider() {
+}
+
+bool MeshCollider::load(const std::string& path) {
+    std::string ext = path.substr(path.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    bool ok;
+    if (ext == "obj") {
+        ok = loadObj(path);
+    } else if (ext == "ply") {
+        ok = loadPly(path);
+    } else {
+        printf("Unsupported mesh format %s\n", path.c_str());
+        return false;
+    }
+    if (ok) {
+        build();
+        printf("Loaded collider %s: %d triangles, %d BVH nodes\n", path.c_str(), numTriangles(), (int)_nodes.size());
+    }
+    return ok;
+}
+
+void MeshCollider::setTriangles(const std::vector<Vector3f>& vertices, const std::vector<int>& indices) {
+    _vertices = vertices;
+    _indices = indices;
+    build();
+}
+
+bool MeshCollider::loadObj(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        printf("Cannot open mesh %s\n", path.c_str());
+        return false;
+    }
+    _vertices.clear();
+    _indices.clear();
+
+    std::string line;
+    std::vector<int> face;
+    while (std::getline(in, line)) {
+        std::istringstream ss(line);
+        std::string tag;
+        ss >> tag;
+        if (tag == "v") {
+            float x, y, z;
+            if (!(ss >> x >> y >> z)) {
+                printf("Bad vertex in %s\n", path.c_str());
+                return false;
+            }
+            _vertices.emplace_back(x, y, z);
+        } else if (tag == "f") {
+            // "f a b c ...", each token may be a, a/t, a//n or a/t/n; negative is relative
+            face.clear();
+            std::string tok;
+            while (ss >> tok) {
+                int idx = atoi(tok.c_str());
+                face.push_back(idx < 0 ? (int)_vertices.size() + idx : idx - 1);
+            }
+            for (size_t k=2; k<face.size(); k++) {  // fan triangulate polygons
+                _indices.push_back(face[0]);
+                _indices.push_back(face[k - 1]);
+                _indices.push_back(face[k]);
+            }
+        }
+    }
+    for (int idx : _indices) {
+        if (idx < 0 || idx >= (int)_vertices.size()) {
+            printf("Bad vertex index in %s\n", path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// size in bytes of a PLY scalar type, 0 if unknown
+static int plyTypeSize(const std::string& t) {
+    if (t == "char" || t == "uchar" || t == "int8" || t == "uint8") return 1;
+    if (t == "short" || t == "ushort" || t == "int16" || t == "uint16") return 2;
+    if (t == "int" || t == "uint" || t == "float" || t == "int32" || t == "uint32" || t == "float32") return 4;
+    if (t == "double" || t == "float64") return 8;
+    return 0;
+}
+
+// read one little endian PLY scalar as double
+static double plyRead(const unsigned char* p, const std::string& t) {
+    if (t == "char" || t == "int8") { int8_t v; memcpy(&v, p, 1); return v; }
+    if (t == "uchar" || t == "uint8") { return p[0]; }
+    if (t == "short" || t == "int16") { int16_t v; memcpy(&v, p, 2); return v; }
+    if (t == "ushort" || t == "uint16") { uint16_t v; memcpy(&v, p, 2); return v; }
+    if (t == "int" || t == "int32") { int32_t v; memcpy(&v, p, 4); return v; }
+    if (t == "uint" || t == "uint32") { uint32_t v; memcpy(&v, p, 4); return v; }
+    if (t == "float" || t == "float32") { float v; memcpy(&v, p, 4); return v; }
+    double v; memcpy(&v, p, 8); return v;
+}
+
+bool MeshCollider::loadPly(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        printf("Cannot open mesh %s\n", path.c_str());
+        return false;
+    }
+    _vertices.clear();
+    _indices.clear();
+
+    // header: only the vertex and face elements are used, others must be ascii-skippable
+    struct Property { std::string name, type, count_type; };
+    struct Element { std::string name; int count; std::vector<Property> props; };
+    std::vector<Element> elements;
+    bool binary = false;
+    std::string line;
+    std::getline(in, line);
+    if (line.compare(0, 3, "ply") != 0) {
+        printf("%s is not a PLY file\n", path.c_str());
+        return false;
+    }
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::istringstream ss(line);
+        std::string tag;
+        ss >> tag;
+        if (tag == "format") {
+            std::string fmt;
+            ss >> fmt;
+            if (fmt == "binary_little_endian") {
+                binary = true;
+            } else if (fmt != "ascii") {
+                printf("Unsupported PLY format %s\n", fmt.c_str());
+                return false;
+            }
+        } else if (tag == "element") {
+            Element e;
+            ss >> e.name >> e.count;
+            elements.push_back(e);
+        } else if (tag == "property" && !elements.empty()) {
+            Property p;
+            ss >> p.type;
+            if (p.type == "list") {
+                ss >> p.count_type >> p.type;
+            }
+            ss >> p.name;
+            elements.back().props.push_back(p);
+        } else if (tag == "end_header") {
+            break;
+        }
+    }
+
+    for (const Element& e : elements) {
+        for (int i=0; i<e.count; i++) {
+            Vector3f v;
+            std::vector<int> face;
+            if (binary) {
+                for (const Property& p : e.props) {
+                    unsigned char buf[8];
+                    if (!p.count_type.empty()) {
+                        int count_size = plyTypeSize(p.count_type);
+                        int item_size = plyTypeSize(p.type);
+                        if (count_size == 0 || item_size == 0) {
+                            printf("Unknown PLY list type %s %s\n", p.count_type.c_str(), p.type.c_str());
+                            return false;
+                        }
+                        in.read((char*)buf, count_size);
+                        double n = in ? plyRead(buf, p.count_type) : 0;
+                        if (!(n >= 0 && n <= MAX_PLY_FACE)) {
+                            printf("Bad PLY list length in %s\n", path.c_str());
+                            return false;
+                        }
+                        for (int k=0; k<(int)n; k++) {
+                            if (!in.read((char*)buf, item_size)) {
+                                break;  // reported as truncated below
+                            }
+                            face.push_back((int)plyRead(buf, p.type));
+                        }
+                    } else {
+                        int size = plyTypeSize(p.type);
+                        if (size == 0) {
+                            printf("Unknown PLY type %s\n", p.type.c_str());
+                            return false;
+                        }
+                        in.read((char*)buf, size);
+                        double value = plyRead(buf, p.type);
+                        if (p.name == "x") v[0] = (float)value;
+                        if (p.name == "y") v[1] = (float)value;
+                        if (p.name == "z") v[2] = (float)value;
+                    }
+                }
+            } else {
+                std::getline(in, line);
+                std::istringstream ss(line);
+                for (const Property& p : e.props) {
+                    if (!p.count_type.empty()) {
+                        int n = 0;
+                        ss >> n;
+                        if (n < 0 || n > MAX_PLY_FACE) {
+                            printf("Bad PLY list length in %s\n", path.c_str());
+                            return false;
+                        }
+                        for (int k=0; k<n; k++) {
+                            int idx;
+                            ss >> idx;
+                            face.push_back(idx);
+                        }
+                    } else {
+                        double value;
+                        ss >> value;
+                        if (p.name == "x") v[0] = (float)value;
+                        if (p.name == "y") v[1] = (float)value;
+                        if (p.name == "z") v[2] = (float)value;
+                    }
+                }
+                // a short or malformed line; a missing one is reported as truncated below
+                if (in && !ss) {
+                    printf("Bad PLY %s in %s\n", e.name.c_str(), path.c_str());
+                    return false;
+                }
+            }
+            if (!in) {
+                printf("Truncated PLY file %s\n", path.c_str());
+                return false;
+            }
+            if (e.name == "vertex") {
+                _vertices.push_back(v);
+            } else if (e.name == "face") {
+                for (size_t k=2; k<face.size(); k++) {
+                    _indices.push_back(face[0]);
+                    _indices.push_back(face[k - 1]);
+                    _indices.push_back(face[k]);
+                }
+            }
+        }
+    }
+    for (int idx : _indices) {
+        if (idx < 0 || idx >= (int)_vertices.size()) {
+            printf("Bad vertex index in %s\n", path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void MeshCollider::build() {
+    int n = numTriangles();
+    _order.resize(n);
+    _centroids.resize(n);
+    for (int t=0; t<n; t++) {
+        _order[t] = t;
+        _centroids[t] = (_vertices[_indices[3*t]] + _vertices[_indices[3*t+1]] + _vertices[_indices[3*t+2]]) / 3;
+    }
+
+    _nodes.clear();
+    if (n == 0) {
+        return;
+    }
+    _nodes.reserve(2 * n);
+    Node root;
+    root.first = 0;
+    root.count = n;
+    _nodes.push_back(root);
+
+    // explicit stack of (node, depth) so deep meshes don't recurse
+    std::vector<std::pair<int, int>> todo;
+    todo.emplace_back(0, 0);
+    while (!todo.empty()) {
+        int node = todo.back().first;
+        int depth = todo.back().second;
+        todo.pop_back();
+
+        // bounds over the node's triangles
+        Node& nd = _nodes[node];
+        nd.lo = Vector3f(INFINITY);
+        nd.hi = Vector3f(-INFINITY);
+        for (int k=nd.first; k<nd.first + nd.count; k++) {
+            int t = _order[k];
+            grow(nd.lo, nd.hi, _vertices[_indices[3*t]]);
+            grow(nd.lo, nd.hi, _vertices[_indices[3*t+1]]);
+            grow(nd.lo, nd.hi, _vertices[_indices[3*t+2]]);
+        }
+        if (depth < MAX_DEPTH) {
+            int left = (int)_nodes.size();
+            split(node);
+            if (_nodes[node].count == 0) {
+                todo.emplace_back(left, depth + 1);
+                todo.emplace_back(left + 1, depth + 1);
+            }
+        }
+    }
+}
+
+// binned SAH split of a leaf into two children, leaves it alone when splitting doesn't pay
+void MeshCollider::split(int node) {
+    int first = _nodes[node].first;
+    int count = _nodes[node].count;
+    if (count <= MIN_LEAF) {
+        return;
+    }
+
+    // split along the widest axis of the centroid bounds
+    Vector3f clo(INFINITY), chi(-INFINITY);
+    for (int k=first; k<first + count; k++) {
+        grow(clo, chi, _centroids[_order[k]]);
+    }
+    int axis = 0;
+    Vector3f extent = chi - clo;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+    if (extent[axis] <= 0) {
+        return;  // all centroids coincide
+    }
+
+    int bin_count[SAH_BINS] = {0};
+    Vector3f bin_lo[SAH_BINS], bin_hi[SAH_BINS];
+    for (int b=0; b<SAH_BINS; b++) {
+        bin_lo[b] = Vector3f(INFINITY);
+        bin_hi[b] = Vector3f(-INFINITY);
+    }
+    float scale = SAH_BINS / extent[axis];
+    for (int k=first; k<first + count; k++) {
+        int t = _order[k];
+        int b = std::min(SAH_BINS - 1, (int)((_centroids[t][axis] - clo[axis]) * scale));
+        bin_count[b] += 1;
+        grow(bin_lo[b], bin_hi[b], _vertices[_indices[3*t]]);
+        grow(bin_lo[b], bin_hi[b], _vertices[_indices[3*t+1]]);
+        grow(bin_lo[b], bin_hi[b], _vertices[_indices[3*t+2]]);
+    }
+
+    // sweep from the right to get suffix areas, then from the left to evaluate each plane
+    float right_area[SAH_BINS];
+    int right_count[SAH_BINS];
+    Vector3f lo(INFINITY), hi(-INFINITY);
+    int acc = 0;
+    for (int b=SAH_BINS - 1; b>0; b--) {
+        grow(lo, hi, bin_lo[b]);
+        grow(lo, hi, bin_hi[b]);
+        acc += bin_count[b];
+        right_area[b] = surfaceArea(lo, hi);
+        right_count[b] = acc;
+    }
+    float best_cost = INFINITY;
+    int best_plane = -1;
+    lo = Vector3f(INFINITY);
+    hi = Vector3f(-INFINITY);
+    acc = 0;
+    for (int b=1; b<SAH_BINS; b++) {
+        grow(lo, hi, bin_lo[b - 1]);
+        grow(lo, hi, bin_hi[b - 1]);
+        acc += bin_count[b - 1];
+        if (acc == 0 || right_count[b] == 0) {
+            continue;
+        }
+        float cost = acc * surfaceArea(lo, hi) + right_count[b] * right_area[b];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_plane = b;
+        }
+    }
+
+    // traversal costs about as much as one triangle test
+    float leaf_cost = count * surfaceArea(_nodes[node].lo, _nodes[node].hi);
+    float split_cost = surfaceArea(_nodes[node].lo, _nodes[node].hi) + best_cost;
+    if (best_plane < 0 || (split_cost >= leaf_cost && count <= MAX_LEAF)) {
+        return;
+    }
+
+    int* mid = std::partition(_order.data() + first, _order.data() + first + count, [&](int t) {
+        return std::min(SAH_BINS - 1, (int)((_centroids[t][axis] - clo[axis]) * scale)) < best_plane;
+    });
+    int left_count = (int)(mid - (_order.data() + first));
+
+    Node left, right;
+    left.first = first;
+    left.count = left_count;
+    right.first = first + left_count;
+    right.count = count - left_count;
+    _nodes[node].first = (int)_nodes.size();
+    _nodes[node].count = 0;
+    _nodes.push_back(left);
+    _nodes.push_back(right);
+}
+
+
+bool MeshCollider::intersectsSphere(const Vector3f& center, float radius, Hit& hit) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    float best_d2 = radius * radius;
+    int best_tri = -1;
+    Vector3f best_point;
+
+    int stack[QUERY_STACK];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& nd = _nodes[stack[--top]];
+        if (boxDistSquared(center, nd.lo, nd.hi) > best_d2) {
+            continue;
+        }
+        if (nd.count == 0) {
+            stack[top++] = nd.first;
+            stack[top++] = nd.first + 1;
+            continue;
+        }
+        for (int k=nd.first; k<nd.first + nd.count; k++) {
+            int t = _order[k];
+            const Vector3f& a = _vertices[_indices[3*t]];
+            const Vector3f& b = _vertices[_indices[3*t+1]];
+            const Vector3f& c = _vertices[_indices[3*t+2]];
+            Vector3f q = closestPointOnTriangle(center, a, b, c);
+            float d2 = (center - q).absSquared();
+            if (d2 <= best_d2) {
+                best_d2 = d2;
+                best_tri = t;
+                best_point = q;
+            }
+        }
+    }
+    if (best_tri < 0) {
+        return false;
+    }
+
+    // push away from the closest point, or along the face normal if the center is on it
+    Vector3f away = center - best_point;
+    float dist = away.abs();
+    if (dist > 1e-6f) {
+        hit.resolveDirection = away / dist;
+    } else {
+        const Vector3f& a = _vertices[_indices[3*best_tri]];
+        Vector3f normal = Vector3f::cross(_vertices[_indices[3*best_tri+1]] - a, _vertices[_indices[3*best_tri+2]] - a);
+        float length = normal.abs();
+        // a zero-area triangle has no normal: straight up, rather than a NaN force
+        hit.resolveDirection = length > 1e-12f ? normal / length : Vector3f(0, 1, 0);
+    }
+    hit.resolveDist = radius - dist;
+    hit.wasHit = true;
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef A3_TRIANGLEMESH_H
+#define A3_TRIANGLEMESH_H
+
+#include <string>
+#include <vector>
+#include <vecmath.h>
+
+#include "hit.h"
+
+/**
+ * Static triangle mesh collider (funnels, bins, chutes...) loaded from an OBJ
+ * or PLY file. Triangles are kept in a bounding volume hierarchy built with
+ * the surface area heuristic, so a sphere query only visits O(log n) nodes.
+ */
+class MeshCollider {
+public:
+    MeshCollider();
+
+    // load an .obj or .ply (ascii or binary_little_endian) file, false on error
+    bool load(const std::string& path);
+
+    // use the given triangles (three vertex indices each) and build the BVH
+    void setTriangles(const std::vector<Vector3f>& vertices, const std::vector<int>& indices);
+
+    // closest mesh point to a sphere; on overlap hit points from the mesh to
+    // the center and resolveDist is the penetration depth
+    bool intersectsSphere(const Vector3f& center, float radius, Hit& hit) const;
+
+    int numTriangles() const { return (int)_indices.size() / 3; }
+    const std::vector<Vector3f>& vertices() const { return _vertices; }
+    const std::vector<int>& indices() const { return _indices; }
+
+private:
+    struct Node {
+        Vector3f lo;
+        Vector3f hi;
+        int first;  // first child for inner nodes, first triangle for leaves
+        int count;  // triangles in a leaf, 0 for inner nodes
+    };
+
+    void build();
+    void split(int node);
+    bool loadObj(const std::string& path);
+    bool loadPly(const std::string& path);
+
+    std::vector<Vector3f> _vertices;
+    std::vector<int> _indices;
+    std::vector<int> _order;  // triangle ids, leaves own contiguous runs
+    std::vector<Vector3f> _centroids;
+    std::vector<Node> _nodes;
+};
+
+// closest point to p on triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+Vector3f closestPointOnTriangle(const Vector3f& p, const Vector3f& a, const Vector3f& b, const Vector3f& c);
+
+
+#endif //A3_TRIANGLEMESH_H
@@ -0,0 +1,60 @@
+#ifndef A3_VEC3_H
+#define A3_VEC3_H
+
+#include <vecmath.h>
+
+/**
+ * Minimal 3-vector over any scalar, for particle state kept wider than
+ * vecmath's float Vector3f (the double stepper state). Only what the
+ * integrators need: construction, indexing and the vector space operations.
+ * Forces are still evaluated on Vector3f, converted at the edges.
+ */
+template <typename T>
+struct Vec3 {
+    T v[3];
+
+    Vec3() : v{0, 0, 0} {}
+    Vec3(T x, T y, T z) : v{x, y, z} {}
+    explicit Vec3(const Vector3f& f) : v{f[0], f[1], f[2]} {}
+
+    T& operator[](int i) { return v[i]; }
+    const T& operator[](int i) const { return v[i]; }
+
+    // rounded to float, for evalF and drawing
+    Vector3f toFloat() const { return Vector3f((float)v[0], (float)v[1], (float)v[2]); }
+
+    Vec3& operator+=(const Vec3& b) { v[0] += b.v[0]; v[1] += b.v[1]; v[2] += b.v[2]; return *this; }
+};
+
+template <typename T>
+inline Vec3<T> operator+(const Vec3<T>& a, const Vec3<T>& b)
+{
+    return Vec3<T>(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2]);
+}
+
+template <typename T>
+inline Vec3<T> operator-(const Vec3<T>& a, const Vec3<T>& b)
+{
+    return Vec3<T>(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2]);
+}
+
+template <typename T>
+inline Vec3<T> operator*(T s, const Vec3<T>& a)
+{
+    return Vec3<T>(s * a.v[0], s * a.v[1], s * a.v[2]);
+}
+
+template <typename T>
+inline Vec3<T> operator*(const Vec3<T>& a, T s)
+{
+    return Vec3<T>(a.v[0] * s, a.v[1] * s, a.v[2] * s);
+}
+
+template <typename T>
+inline Vec3<T> operator/(const Vec3<T>& a, T s)
+{
+    return Vec3<T>(a.v[0] / s, a.v[1] / s, a.v[2] / s);
+}
+
+
+#endif //A3_VEC3_H
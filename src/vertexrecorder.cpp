@@ -2,14 +2,70 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
 #include "gl.h"
 
 #ifndef M_PIf
 #define M_PIf 3.141592f
 #endif
 
-VertexRecorder::VertexRecorder() :m_nverts(0)
+namespace {
+// storage of destroyed recorders, capacity intact
+struct RecorderStorage {
+    std::vector<Vector3f> position;
+    std::vector<Vector3f> normal;
+    std::vector<Vector3f> color;
+};
+std::vector<RecorderStorage> storage_pool;
+#ifndef NDEBUG
+int allocations = 0;
+#endif
+}
+
+VertexRecorder::VertexRecorder(int vertices_hint) :m_nverts(0)
+{
+    if (!storage_pool.empty()) {
+        RecorderStorage& s = storage_pool.back();
+        m_position.swap(s.position);
+        m_normal.swap(s.normal);
+        m_color.swap(s.color);
+        storage_pool.pop_back();
+    }
+    reserve(vertices_hint);
+}
+
+VertexRecorder::~VertexRecorder()
 {
+    clear();
+    storage_pool.emplace_back();
+    RecorderStorage& s = storage_pool.back();
+    s.position.swap(m_position);
+    s.normal.swap(m_normal);
+    s.color.swap(m_color);
+}
+
+void VertexRecorder::reserve(int vertices)
+{
+    if ((size_t)vertices <= m_position.capacity()) {
+        return;
+    }
+#ifndef NDEBUG
+    allocations += 3;
+#endif
+    m_position.reserve(vertices);
+    m_normal.reserve(vertices);
+    m_color.reserve(vertices);
+}
+
+int VertexRecorder::takeAllocationCount()
+{
+#ifndef NDEBUG
+    int count = allocations;
+    allocations = 0;
+    return count;
+#else
+    return 0;
+#endif
 }
 
 void VertexRecorder::record(Vector3f pos,
@@ -24,6 +80,11 @@ void VertexRecorder::record_poscolor(Vector3f pos,
 void VertexRecorder::record(Vector3f pos,
     Vector3f normal,
     Vector3f color) {
+#ifndef NDEBUG
+    if (m_position.size() == m_position.capacity()) {
+        allocations += 3;  // no or too small a reserve hint
+    }
+#endif
     m_position.push_back(pos);
     m_normal.push_back(normal);
     m_color.push_back(color);
@@ -107,8 +168,7 @@ void drawSphere(float r, int slices, int stacks) {
     assert(stacks > 1);
     assert(r > 0);
 
-    // TODO reuse recorder if sphere meshing becomes a bottleneck.
-    VertexRecorder rec;
+    VertexRecorder rec(6 * slices * stacks);
 
     float phistep = M_PIf * 2 / slices;
     float thetastep = M_PIf / stacks;
@@ -173,31 +233,17 @@ void drawCylinder(int nsides, float r, float h) {
     assert(nsides >= 3);
     float step = 2 * M_PIf / nsides;
 
-    VertexRecorder rec;
-    std::vector<Vector3f> pos;
-    std::vector<Vector3f> n;
-
-    int posidx = 0;
-    int nidx = 0;
-    int uvidx = 0;
-    int idxidx = 0;
-    for (int face = 0; face < nsides; ++face) {
-        float lx = r * cosf(face * step);
-        float lz = r * sinf(face * step);
-        pos.push_back(Vector3f(lx, 0.0f, lz));
-        pos.push_back(Vector3f(lx, h, lz));
-
-        n.push_back(Vector3f(cosf(face * step), 0.0f, sinf(face * step)));
-        n.push_back(Vector3f(cosf(face * step), h, sinf(face * step)));
-
-        //if (uv) {
-            //uv[uvidx++] = (float)(face) / (nsides - 1);
-            //uv[uvidx++] = 1.0f;
-//
-            //uv[uvidx++] = (float)(face) / (nsides - 1);
-            //uv[uvidx++] = 0.0f;
-        //}
-    }
+    VertexRecorder rec(6 * nsides);
+
+    // ring vertices, bottom (even) and top (odd) per face, computed on demand
+    auto pos = [&](int i) {
+        int face = i / 2;
+        return Vector3f(r * cosf(face * step), i % 2 ? h : 0.0f, r * sinf(face * step));
+    };
+    auto n = [&](int i) {
+        int face = i / 2;
+        return Vector3f(cosf(face * step), i % 2 ? h : 0.0f, sinf(face * step));
+    };
     for (int face = 0; face < nsides; ++face) {
         int i1 = face * 2;
         int i2;
@@ -209,9 +255,9 @@ void drawCylinder(int nsides, float r, float h) {
         int i3 = i1 + 1;
 
         // draw
-        rec.record(pos[i1], n[i1]);
-        rec.record(pos[i2], n[i2]);
-        rec.record(pos[i3], n[i3]);
+        rec.record(pos(i1), n(i1));
+        rec.record(pos(i2), n(i2));
+        rec.record(pos(i3), n(i3));
 
         if (face == nsides - 1) {
             i2 = 0;
@@ -221,16 +267,16 @@ void drawCylinder(int nsides, float r, float h) {
             i2 = i1 + 2;
             i3 = i1 + 3;
         }
-        rec.record(pos[i1], n[i1]);
-        rec.record(pos[i2], n[i2]);
-        rec.record(pos[i3], n[i3]);
+        rec.record(pos(i1), n(i1));
+        rec.record(pos(i2), n(i2));
+        rec.record(pos(i3), n(i3));
     }
     rec.draw();
 }
 
 void drawQuad(float w)
 {
-    VertexRecorder rec;
+    VertexRecorder rec(6);
     float wh = w / 2;
     const Vector3f N(0, 1, 0);
     const Vector3f P1(-wh, 0, -wh);
@@ -7,7 +7,14 @@
 
 class VertexRecorder{ 
 public:
-    VertexRecorder();
+    // vertices_hint reserves room up front. the vertex storage is borrowed from
+    // a pool and handed back on destruction, so recorders built every frame
+    // reuse the capacity of earlier frames. GL thread only, like drawing
+    explicit VertexRecorder(int vertices_hint = 0);
+    ~VertexRecorder();
+    VertexRecorder(const VertexRecorder&) = delete;
+    VertexRecorder& operator=(const VertexRecorder&) = delete;
+    void reserve(int vertices);
     // write a vertex into the CPU buffer
     void record(Vector3f pos,
                 Vector3f normal);
@@ -20,6 +27,10 @@ public:
     void draw(GLenum mode = GL_TRIANGLES);
     // empties the recording buffer.
     void clear();
+
+    // vertex storage allocations since the last call (debug builds only,
+    // always 0 with NDEBUG), for the per-frame report
+    static int takeAllocationCount();
 private:
     int m_nverts;
     std::vector<Vector3f> m_position;
@@ -1,5 +1,11 @@
 #include "wall.h"
 
+#include <cassert>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 Wall::Wall(Vector3f bottom_left_corner, Vector3f top_left_corner, Vector3f top_right_corner) {
     Vector3f u = top_left_corner - bottom_left_corner;
@@ -14,3 +20,65 @@ Wall::Wall(Vector3f bottom_left_corner, Vector3f top_left_corner, Vector3f top_r
     _zmin = bottom_left_corner[2];
     _zmax = top_right_corner[2];
 }
+
+
+PlaneTable::PlaneTable() {
+}
+
+PlaneTable::PlaneTable(const std::vector<Wall>& walls) {
+    assert(walls.size() <= 32);
+    for (const Wall& wall : walls) {
+        _nx.push_back(wall._normal[0]);
+        _ny.push_back(wall._normal[1]);
+        _nz.push_back(wall._normal[2]);
+        _d.push_back(wall._d);
+    }
+}
+
+
+void intersectsPlanes(const PlaneTable& planes, const float* cx, const float* cy, const float* cz,
+                      const float* radius, int count, uint32_t* hit_mask, float* depth, size_t depth_stride) {
+    for (int i=0; i<count; i++) {
+        hit_mask[i] = 0;
+    }
+
+    for (int j=0; j<planes.size(); j++) {
+        float nx = planes._nx[j];
+        float ny = planes._ny[j];
+        float nz = planes._nz[j];
+        float d = planes._d[j];
+        uint32_t bit = 1u << j;
+        float* row = depth + (size_t)j * depth_stride;
+
+        int i = 0;
+#ifdef __SSE2__
+        // four spheres per iteration
+        __m128 vnx = _mm_set1_ps(nx);
+        __m128 vny = _mm_set1_ps(ny);
+        __m128 vnz = _mm_set1_ps(nz);
+        __m128 vd = _mm_set1_ps(d);
+        __m128 sign = _mm_set1_ps(-0.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vnx, _mm_loadu_ps(cx + i)),
+                                                _mm_mul_ps(vny, _mm_loadu_ps(cy + i))),
+                                     _mm_add_ps(_mm_mul_ps(vnz, _mm_loadu_ps(cz + i)), vd));
+            dist = _mm_andnot_ps(sign, dist);  // abs
+            __m128 r = _mm_loadu_ps(radius + i);
+            _mm_storeu_ps(row + i, _mm_sub_ps(r, dist));
+
+            int lanes = _mm_movemask_ps(_mm_cmple_ps(dist, r));
+            hit_mask[i] |= (lanes & 1) ? bit : 0;
+            hit_mask[i + 1] |= (lanes & 2) ? bit : 0;
+            hit_mask[i + 2] |= (lanes & 4) ? bit : 0;
+            hit_mask[i + 3] |= (lanes & 8) ? bit : 0;
+        }
+#endif
+        for (; i<count; i++) {
+            float dist = fabsf(nx * cx[i] + ny * cy[i] + nz * cz[i] + d);
+            row[i] = radius[i] - dist;
+            if (dist <= radius[i]) {
+                hit_mask[i] |= bit;
+            }
+        }
+    }
+}
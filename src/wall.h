@@ -1,6 +1,8 @@
 #ifndef A3_PLANE_H
 #define A3_PLANE_H
 
+#include <cstdint>
+#include <vector>
 #include <vecmath.h>
 
 class Wall{
@@ -19,4 +21,35 @@ public:
 };
 
 
+/**
+ * Structure-of-arrays copy of every wall plane (unit normal and offset _d),
+ * packed so one sphere block can be tested against all planes with SIMD.
+ * At most 32 planes so a sphere's hits fit one bit mask.
+ */
+class PlaneTable {
+public:
+    PlaneTable();
+    explicit PlaneTable(const std::vector<Wall>& walls);
+
+    int size() const { return (int)_d.size(); }
+
+    std::vector<float> _nx;
+    std::vector<float> _ny;
+    std::vector<float> _nz;
+    std::vector<float> _d;
+};
+
+/**
+ * Tests count spheres (SoA centers and radii) against every plane in one pass.
+ *
+ * @param hit_mask per sphere, bit j set when the sphere touches plane j
+ * @param depth plane-major penetration depths, depth[j*depth_stride + i] = radius - |distance|
+ *              (only meaningful where the mask bit is set)
+ * @param depth_stride distance between plane rows, at least count; larger to
+ *                     test a chunk of spheres in place in a bigger table
+ */
+void intersectsPlanes(const PlaneTable& planes, const float* cx, const float* cy, const float* cz,
+                      const float* radius, int count, uint32_t* hit_mask, float* depth, size_t depth_stride);
+
+
 #endif //A3_PLANE_H